@@ -0,0 +1,194 @@
+/**
+ * Implementation of a reusable sieve for the prime before a given number
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "BackwardSieve.h"
+
+/* creates a sieve with the given primes below BACKWARD_SIEVE_LIMIT */
+BackwardSieve::BackwardSieve(const sieve_t *primes,
+                             sieve_t n_primes,
+                             FermatBackend *fermat) {
+
+  this->primes          = (uint32_t *) malloc(sizeof(uint32_t) * n_primes);
+  this->product_starts  = (sieve_t *) malloc(sizeof(sieve_t) * (n_primes + 1));
+  this->products        = (uint64_t *) malloc(sizeof(uint64_t) * n_primes);
+  this->n_primes        = 0;
+  this->n_products      = 0;
+
+  /* 2 is skipped, only odd offsets are sieved */
+  for (sieve_t i = 0; i < n_primes && primes[i] < BACKWARD_SIEVE_LIMIT; i++) {
+    if (primes[i] == 2)
+      continue;
+
+    /* starts a new product if the prime doesn't fit into a limb */
+    if (n_products == 0 || products[n_products - 1] > GMP_NUMB_MAX / primes[i]) {
+      product_starts[n_products] = this->n_primes;
+      products[n_products++]     = 1;
+    }
+
+    products[n_products - 1] *= primes[i];
+    this->primes[this->n_primes++] = primes[i];
+  }
+  product_starts[n_products] = this->n_primes;
+
+  this->reminder        = (uint32_t *) malloc(sizeof(uint32_t) * this->n_primes);
+  this->window_reminder = (uint32_t *) malloc(sizeof(uint32_t) * this->n_primes);
+  this->window          = (sieve_t *) malloc(BACKWARD_SIEVE_SIZE / 8);
+
+  for (sieve_t i = 0; i < this->n_primes; i++)
+    window_reminder[i] = BACKWARD_SIEVE_SIZE % this->primes[i];
+
+  this->fermat      = fermat;
+  this->lanes       = fermat->get_lanes();
+  this->mpz_numbers = (mpz_t *) malloc(sizeof(mpz_t) * lanes);
+  this->mpz_p       = (mpz_ptr *) malloc(sizeof(mpz_ptr) * lanes);
+  this->results     = (bool *) malloc(sizeof(bool) * lanes);
+
+  for (sieve_t i = 0; i < lanes; i++) {
+    mpz_init(mpz_numbers[i]);
+    mpz_p[i] = mpz_numbers[i];
+  }
+  mpz_init(mpz_start);
+
+  log_str("creating BackwardSieve with " + itoa(this->n_primes) + " primes in " +
+          itoa(n_products) + " products", LOG_D);
+}
+
+BackwardSieve::~BackwardSieve() {
+
+  for (sieve_t i = 0; i < lanes; i++)
+    mpz_clear(mpz_numbers[i]);
+
+  mpz_clear(mpz_start);
+  free(mpz_numbers);
+  free(mpz_p);
+  free(results);
+  free(primes);
+  free(products);
+  free(product_starts);
+  free(reminder);
+  free(window_reminder);
+  free(window);
+}
+
+/**
+ * calculates the reminders of the window start
+ * (one division per product, the primes of a product only need 64 bit)
+ */
+void BackwardSieve::calc_reminder() {
+
+  for (sieve_t i = 0; i < n_products; i++) {
+    const uint64_t rem = mpn_mod_1(mpz_limbs_read(mpz_start),
+                                   mpz_size(mpz_start),
+                                   (mp_limb_t) products[i]);
+
+    for (sieve_t j = product_starts[i]; j < product_starts[i + 1]; j++)
+      reminder[j] = rem % primes[j];
+  }
+}
+
+/* moves the reminders to the next lower window */
+void BackwardSieve::next_window() {
+
+  for (sieve_t i = 0; i < n_primes; i++) {
+    if (reminder[i] >= window_reminder[i])
+      reminder[i] -= window_reminder[i];
+    else
+      reminder[i] += primes[i] - window_reminder[i];
+  }
+}
+
+/* sieves the current window (the offsets have the given parity) */
+void BackwardSieve::sieve_window(sieve_t parity) {
+
+  memset(window, 0, BACKWARD_SIEVE_SIZE / 8);
+
+  for (sieve_t i = 0; i < n_primes; i++) {
+    const sieve_t prime = primes[i];
+
+    /* first d with start - d = 0 mod prime */
+    sieve_t d = reminder[i];
+    if ((d & 1) != parity)
+      d += prime;
+
+    for (; d < BACKWARD_SIEVE_SIZE; d += 2 * prime)
+      set_composite(window, d);
+  }
+}
+
+/**
+ * tests the offsets start, start + 2, ... < end not marked in sieve, and
+ * sets dst to src - d of the lowest prime offset (returns false if
+ * there is none)
+ *
+ * the offsets are tested in batches, so a few tests after the prime
+ * are wasted if the backend has more than one lane
+ */
+bool BackwardSieve::test_window(mpz_t mpz_dst,
+                                mpz_t mpz_src,
+                                const sieve_t *sieve,
+                                sieve_t start,
+                                sieve_t end) {
+
+  sieve_t n = 0;
+  for (sieve_t d = start; d < end || n > 0; d += 2) {
+
+    if (d < end) {
+      if (!is_prime(sieve, d))
+        continue;
+
+      mpz_sub_ui(mpz_numbers[n++], mpz_src, d);
+
+      if (n < lanes && d + 2 < end)
+        continue;
+    }
+
+    fermat->fermat_test(mpz_p, results, n);
+
+    for (sieve_t i = 0; i < n; i++) {
+      if (results[i]) {
+        mpz_set(mpz_dst, mpz_numbers[i]);
+        return true;
+      }
+    }
+    n = 0;
+  }
+
+  return false;
+}
+
+/* finds the prevoius prime for a given mpz value (if src is not a prime) */
+void BackwardSieve::previous_prime(mpz_t mpz_dst, mpz_t mpz_src) {
+
+  /* offsets with start - d odd */
+  const sieve_t parity = (mpz_get_ui64(mpz_src) & 1) ^ 1;
+
+  mpz_set(mpz_start, mpz_src);
+  calc_reminder();
+
+  for (;;) {
+    sieve_window(parity);
+
+    if (test_window(mpz_dst, mpz_start, window, parity, BACKWARD_SIEVE_SIZE))
+      return;
+
+    mpz_sub_ui(mpz_start, mpz_start, BACKWARD_SIEVE_SIZE);
+    next_window();
+  }
+}
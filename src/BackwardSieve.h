@@ -0,0 +1,110 @@
+/**
+ * Header file of a reusable sieve for the prime before a given number
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __BACKWARD_SIEVE_H__
+#define __BACKWARD_SIEVE_H__
+
+#include <gmp.h>
+#include <inttypes.h>
+#include "FermatBackend.h"
+#include "utils.h"
+
+/* offsets sieved at once (a few average gaps) */
+#define BACKWARD_SIEVE_SIZE (1 << 12)
+
+/**
+ * largest prime to sieve with, larger primes remove to few numbers
+ * to be worth there reminder
+ */
+#define BACKWARD_SIEVE_LIMIT (1 << 14)
+
+/**
+ * Finds the prime before a given number.
+ *
+ * The odd offsets d below the number are sieved in windows of
+ * BACKWARD_SIEVE_SIZE. The reminders of the sieve primes are calculated
+ * once per search (with one division per product of primes which fits
+ * into 64 bit) and are updated for the next window without divisions.
+ *
+ * The remaining offsets are Fermat tested in batches of the lanes of
+ * the given backend, the first prime is the one with the lowest offset.
+ */
+class BackwardSieve {
+
+  public:
+
+    /* creates a sieve with the given primes below BACKWARD_SIEVE_LIMIT */
+    BackwardSieve(const sieve_t *primes, sieve_t n_primes, FermatBackend *fermat);
+
+    ~BackwardSieve();
+
+    /* finds the prevoius prime for a given mpz value (if src is not a prime) */
+    void previous_prime(mpz_t mpz_dst, mpz_t mpz_src);
+
+    /**
+     * tests the offsets start, start + 2, ... < end not marked in sieve, and
+     * sets dst to src - d of the lowest prime offset (returns false if
+     * there is none)
+     */
+    bool test_window(mpz_t mpz_dst,
+                     mpz_t mpz_src,
+                     const sieve_t *sieve,
+                     sieve_t start,
+                     sieve_t end);
+
+  private:
+
+    /* the odd sieve primes */
+    uint32_t *primes;
+    sieve_t n_primes;
+
+    /* products of consecutive primes, and the index of there first prime */
+    uint64_t *products;
+    sieve_t *product_starts;
+    sieve_t n_products;
+
+    /* start % prime of the current window */
+    uint32_t *reminder;
+
+    /* BACKWARD_SIEVE_SIZE % prime */
+    uint32_t *window_reminder;
+
+    /* the start of the current window */
+    mpz_t mpz_start;
+
+    /* the current window (bit d marks start - d as composite) */
+    sieve_t *window;
+
+    /* the Fermat test and its buffers */
+    FermatBackend *fermat;
+    sieve_t lanes;
+    mpz_t *mpz_numbers;
+    mpz_ptr *mpz_p;
+    bool *results;
+
+    /* calculates the reminders of the window start */
+    void calc_reminder();
+
+    /* moves the reminders to the next lower window */
+    void next_window();
+
+    /* sieves the current window (the offsets have the given parity) */
+    void sieve_window(sieve_t parity);
+};
+
+#endif /* __BACKWARD_SIEVE_H__ */
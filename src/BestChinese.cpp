@@ -97,35 +97,45 @@ sieve_t BestChinese::calc_best_residues(bool save) {
   primorial = 1;
 
   srand(time(NULL));
-  sieve_t avg_count = 0;
 
-  /** calculate the average candidates per sieve */
-  for (ssieve_t i = 0; i < this->avg_tests; i++) {
+  /* the average number of composites per sieve */
+  const double avg_composite = sievesize - expected_candidates(first_primes, n_primes, sievesize);
 
-    if (verbose) {
-      cout << "running: " << this->avg_tests - i << "    \r";
-    }
-    memset(sieve, 0, byte_size);
+  if (Opts::get_instance()->has_validate_avg()) {
+    sieve_t avg_count = 0;
 
-    /* create a random sieve */
-    for (sieve_t x = 0; x < n_primes; x++) {
-    
-      const sieve_t index = rand() % first_primes[x];
-      const sieve_t prime = first_primes[x];
+    /** calculate the average candidates per sieve */
+    for (ssieve_t i = 0; i < this->avg_tests; i++) {
+
+      if (verbose) {
+        cout << "running: " << this->avg_tests - i << "    \r";
+      }
+      memset(sieve, 0, byte_size);
+
+      /* create a random sieve */
+      for (sieve_t x = 0; x < n_primes; x++) {
       
-      for (sieve_t p = prime - index; p < sievesize; p += prime)
-        set_composite(sieve, p);
+        const sieve_t index = rand() % first_primes[x];
+        const sieve_t prime = first_primes[x];
+        
+        for (sieve_t p = prime - index; p < sievesize; p += prime)
+          set_composite(sieve, p);
 
-    }
+      }
 
-    /* count the candidates */
-    sieve_t cur_count = 0;
-    for (sieve_t s = 0; s < sieve_end; s++)
-      cur_count += popcount(sieve[s]);
+      /* count the candidates */
+      sieve_t cur_count = 0;
+      for (sieve_t s = 0; s < sieve_end; s++)
+        cur_count += popcount(sieve[s]);
 
-    avg_count += cur_count;
-  }
+      avg_count += cur_count;
+    }
 
+    if (verbose) {
+      cout << "[" << this->i << "] avg: " << avg_composite;
+      cout << " sampled: " << ((double) avg_count) / this->avg_tests << endl;
+    }
+  }
 
   memset(sieve, 0, byte_size);
   memset(prev_layers, 0, byte_size);
@@ -217,11 +227,11 @@ sieve_t BestChinese::calc_best_residues(bool save) {
         max = i;
         max_count = cur_count;
         if (verbose) {
-          cout << "[" << this->i << "] (greedy) avg: " << avg_count / this->avg_tests;
+          cout << "[" << this->i << "] (greedy) avg: " << (sieve_t) avg_composite;
           cout << " max: " << max_count << " / " << sievesize;
           double max_candidates = sievesize - max_count;
-          double avg_candidates = sievesize - (((double) avg_count) / this->avg_tests);
-          cout << " => " << ((long long) max_count) - ((long long) avg_count) / this->avg_tests << ", ";
+          double avg_candidates = sievesize - avg_composite;
+          cout << " => " << ((long long) max_count) - (long long) avg_composite << ", ";
           cout << 100.0 - (max_candidates / avg_candidates) * 100;
           cout << " % less";
           cout << "                          " << endl;
@@ -336,11 +346,11 @@ sieve_t BestChinese::calc_best_residues(bool save) {
         max = i;
         max_count = cur_count;
         if (verbose) {
-          cout << "[" << this->i << "] (greedy) avg: " << avg_count / this->avg_tests;
+          cout << "[" << this->i << "] (greedy) avg: " << (sieve_t) avg_composite;
           cout << " max: " << max_count << " / " << sievesize;
           double max_candidates = sievesize - max_count;
-          double avg_candidates = sievesize - (((double) avg_count) / this->avg_tests);
-          cout << " => " << ((long long) max_count) - ((long long) avg_count) / this->avg_tests<< ", ";
+          double avg_candidates = sievesize - avg_composite;
+          cout << " => " << ((long long) max_count) - (long long) avg_composite << ", ";
           cout << 100.0 - (max_candidates / avg_candidates) * 100;
           cout << " % less";
           cout << "                          " << endl;
@@ -369,16 +379,16 @@ sieve_t BestChinese::calc_best_residues(bool save) {
   
 
   double max_candidates = sievesize - max_count;
-  double avg_candidates = sievesize - (((double) avg_count) / this->avg_tests);
+  double avg_candidates = sievesize - avg_composite;
 
   if (verbose) {
     cout << "[" << this->i << "] max: " << max_count;
-    cout << " avg: " << avg_count / this->avg_tests << endl;
+    cout << " avg: " << (sieve_t) avg_composite << endl;
     cout << " " << 100.0 - (max_candidates / avg_candidates) * 100;
     cout << " % more composite numbers than average" << endl;
     cout << " " << exp((1.0 - (max_candidates / avg_candidates)) * merit) << " factor speed increase" << endl;
-    cout << " " << max_count - (avg_count / this->avg_tests) << " candidates less" << endl;
-    cout << " " << sievesize - (avg_count / this->avg_tests) << " candidates avg" << endl;
+    cout << " " << max_count - (sieve_t) avg_composite << " candidates less" << endl;
+    cout << " " << sievesize - (sieve_t) avg_composite << " candidates avg" << endl;
     cout << " " << sievesize - max_count << " candidates max" << endl;
     cout << " " << (avg_candidates / sievesize) * 100 << " % prime candidates avg" << endl;
     cout << " " << (max_candidates / sievesize) * 100 << " % prime candidates min" << endl;
@@ -53,7 +53,7 @@ class BestChinese {
     /* the target merit */
     double merit;
 
-    /* the number of test to calculate the average number of candidates */
+    /* the number of random sieves to validate the average number of candidates */
     ssieve_t avg_tests;
 
     /* the maximum number of greedy iterations */
@@ -0,0 +1,215 @@
+/**
+ * Implementation of the batched Fermat test of the HybridSieve on cpu threads
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "CPUFermat.h"
+#include "utils.h"
+
+/* synchronization mutexes */
+pthread_mutex_t CPUFermat::creation_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the only instance of this */
+CPUFermat *CPUFermat::only_instance = NULL;
+
+/* return the only instance of this */
+CPUFermat *CPUFermat::get_instance(unsigned n_threads, 
+                                   unsigned work_items,
+                                   uint64_t n_sieve_primes,
+                                   uint64_t n_filter_primes) {
+
+  pthread_mutex_lock(&creation_mutex);
+  if (only_instance == NULL)
+    only_instance = new CPUFermat((n_threads > 0) ? n_threads : 1,
+                                  (work_items > 0) ? work_items : 512,
+                                  n_sieve_primes,
+                                  n_filter_primes);
+  pthread_mutex_unlock(&creation_mutex);
+
+  return only_instance;
+}
+
+/* this is a singleton */
+CPUFermat::CPUFermat(unsigned n_threads, 
+                     unsigned work_items,
+                     uint64_t n_sieve_primes,
+                     uint64_t n_filter_primes) {
+
+  log_str("creating CPUFermat with " + itoa(n_threads) + " threads and " +
+          itoa(work_items) + " work items", LOG_D);
+
+  this->n_threads  = n_threads;
+  this->n_elements = work_items * CPU_FERMAT_GROUP_SIZE;
+  this->candidates = (uint32_t *) calloc(n_elements, sizeof(uint32_t));
+  this->results    = (uint32_t *) calloc(n_elements, sizeof(uint32_t));
+  this->threads    = (pthread_t *) malloc(sizeof(pthread_t) * n_threads);
+  this->next       = 0;
+  this->run        = 0;
+  this->n_busy     = 0;
+  this->n_filtered = 0;
+  this->n_filtered_logged = 0;
+  this->gcd_filter = NULL;
+  this->chunk_size = CPU_FERMAT_CHUNK;
+
+  if (n_filter_primes > 0) {
+    this->gcd_filter = new GcdFilter(n_sieve_primes, n_filter_primes);
+    this->chunk_size = GCD_FILTER_BATCH;
+  }
+
+  memset(prime_base, 0, sizeof(prime_base));
+  mpz_init(mpz_base);
+
+  /* calibrate the Fermat tests before the (idle priority) workers start */
+  delete FermatBackend::create_fastest(CPU_FERMAT_OPERAND_SIZE * 32, true);
+
+  pthread_mutex_init(&run_mutex, NULL);
+  pthread_cond_init(&start_cond, NULL);
+  pthread_cond_init(&done_cond, NULL);
+
+  for (unsigned i = 0; i < n_threads; i++)
+    pthread_create(&threads[i], NULL, worker_thread, (void *) this);
+}
+
+/* returns a pointer to the results buffer */
+uint32_t *CPUFermat::get_results_buffer() { return results; }
+
+/* returns a pointer to the prime_base buffer */
+uint32_t *CPUFermat::get_prime_base_buffer() { return prime_base; }
+
+/* returns a pointer to the candidates buffer */
+uint32_t *CPUFermat::get_candidates_buffer() { return candidates; }
+
+/* tests all candidates on the worker threads */
+void CPUFermat::fermat_gpu() {
+
+  /* the candidates replace the lowest 32 bits of the prime base */
+  mpz_import(mpz_base, CPU_FERMAT_OPERAND_SIZE, -1, 4, 0, 0, prime_base);
+  mpz_fdiv_q_2exp(mpz_base, mpz_base, 32);
+  mpz_mul_2exp(mpz_base, mpz_base, 32);
+
+  pthread_mutex_lock(&run_mutex);
+  next   = 0;
+  n_busy = n_threads;
+  run++;
+  pthread_cond_broadcast(&start_cond);
+
+  while (n_busy > 0)
+    pthread_cond_wait(&done_cond, &run_mutex);
+
+  pthread_mutex_unlock(&run_mutex);
+
+  /* logs the filtered candidates of the last CPU_FERMAT_LOG_RUNS runs */
+  if (gcd_filter != NULL && run % CPU_FERMAT_LOG_RUNS == 0) {
+    const uint64_t filtered = n_filtered;
+    log_str("CPUFermat filtered " + itoa(filtered - n_filtered_logged) + " of " + 
+            itoa(((uint64_t) n_elements) * CPU_FERMAT_LOG_RUNS) + " candidates", LOG_D);
+    n_filtered_logged = filtered;
+  }
+}
+
+/* tests chunks of the candidates until all are taken */
+void CPUFermat::test_chunks(Worker *worker) {
+
+  const unsigned lanes = worker->fermat->get_lanes();
+
+  for (;;) {
+    const unsigned start = __sync_fetch_and_add(&next, chunk_size);
+    if (start >= n_elements)
+      return;
+
+    const unsigned n = (start + chunk_size < n_elements) ? chunk_size : n_elements - start;
+
+    for (unsigned i = 0; i < n; i++) {
+      mpz_add_ui(worker->mpz_numbers[i], mpz_base, candidates[start + i]);
+      worker->mpz_p[i]     = worker->mpz_numbers[i];
+      worker->composite[i] = false;
+    }
+
+    if (gcd_filter != NULL)
+      gcd_filter->filter(worker->mpz_p, worker->composite, n);
+
+    /* only the remaining candidates are Fermat tested */
+    unsigned n_test = 0;
+    for (unsigned i = 0; i < n; i++) {
+      if (worker->composite[i]) {
+        results[start + i] = 0;
+      } else {
+        worker->mpz_p[n_test]   = worker->mpz_numbers[i];
+        worker->index[n_test++] = start + i;
+      }
+    }
+
+    if (gcd_filter != NULL)
+      __sync_fetch_and_add(&n_filtered, n - n_test);
+
+    for (unsigned i = 0; i < n_test; i += lanes) {
+      const unsigned n_lane = (i + lanes < n_test) ? lanes : n_test - i;
+
+      worker->fermat->fermat_test(worker->mpz_p + i, worker->found, n_lane);
+
+      for (unsigned l = 0; l < n_lane; l++)
+        results[worker->index[i + l]] = worker->found[l];
+    }
+  }
+}
+
+/* a worker thread */
+void *CPUFermat::worker_thread(void *args) {
+
+#ifndef WINDOWS
+  /* use idle CPU cycles for mining */
+  struct sched_param param;
+  param.sched_priority = sched_get_priority_min(SCHED_IDLE);
+  sched_setscheduler(0, SCHED_IDLE, &param);
+#endif
+
+  CPUFermat *cfermat = (CPUFermat *) args;
+
+  /* the numbers have the width of the prime base */
+  Worker worker;
+  const unsigned size = cfermat->chunk_size;
+  worker.fermat       = FermatBackend::create_fastest(CPU_FERMAT_OPERAND_SIZE * 32, true);
+  worker.mpz_numbers  = (mpz_t *) malloc(sizeof(mpz_t) * size);
+  worker.composite    = (bool *) malloc(sizeof(bool) * size);
+  worker.mpz_p        = (mpz_ptr *) malloc(sizeof(mpz_ptr) * size);
+  worker.index        = (unsigned *) malloc(sizeof(unsigned) * size);
+  worker.found        = (bool *) malloc(sizeof(bool) * worker.fermat->get_lanes());
+
+  for (unsigned i = 0; i < size; i++)
+    mpz_init(worker.mpz_numbers[i]);
+
+  uint64_t done = 0;
+  pthread_mutex_lock(&cfermat->run_mutex);
+
+  for (;;) {
+    while (cfermat->run == done)
+      pthread_cond_wait(&cfermat->start_cond, &cfermat->run_mutex);
+
+    done = cfermat->run;
+    pthread_mutex_unlock(&cfermat->run_mutex);
+
+    cfermat->test_chunks(&worker);
+
+    pthread_mutex_lock(&cfermat->run_mutex);
+    if (--cfermat->n_busy == 0)
+      pthread_cond_signal(&cfermat->done_cond);
+  }
+
+  return NULL;
+}
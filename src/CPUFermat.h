@@ -0,0 +1,150 @@
+/**
+ * Header file of the batched Fermat test of the HybridSieve on cpu threads
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __CPU_FERMAT_H__
+#define __CPU_FERMAT_H__
+
+#include <pthread.h>
+#include <inttypes.h>
+#include <gmp.h>
+#include "FermatBackend.h"
+#include "GcdFilter.h"
+
+/* candidates per work item (the group size of the gpu) */
+#define CPU_FERMAT_GROUP_SIZE 256
+
+/* uint32_t words of the prime base (the operand size of the gpu) */
+#define CPU_FERMAT_OPERAND_SIZE 10
+
+/* candidates a worker takes at once */
+#define CPU_FERMAT_CHUNK 256
+
+/* runs between the logs of the gcd pre-filter */
+#define CPU_FERMAT_LOG_RUNS 256
+
+/**
+ * A singleton class which runs the Fermat tests of the HybridSieve on
+ * a pool of cpu threads, with the same buffers as the GPUFermat:
+ * all candidates share the prime base, except for the lowest 32 bits
+ * which are given by the candidates buffer.
+ *
+ * Each worker takes chunks of the candidates and tests them with the
+ * fastest FermatBackend for batches. Optionally the candidates with a
+ * factor slightly above the sieve limit are removed first by a batch
+ * gcd (then the chunks are GCD_FILTER_BATCH large).
+ */
+class CPUFermat {
+
+  public:
+
+    /* return the only instance of this */
+    static CPUFermat *get_instance(unsigned n_threads = 0,
+                                   unsigned work_items = 0,
+                                   uint64_t n_sieve_primes = 0,
+                                   uint64_t n_filter_primes = 0);
+
+    /* returns a pointer to the results buffer */
+    uint32_t *get_results_buffer();
+
+    /* returns a pointer to the prime_base buffer */
+    uint32_t *get_prime_base_buffer();
+
+    /* returns a pointer to the candidates buffer */
+    uint32_t *get_candidates_buffer();
+
+    /**
+     * tests all candidates on the worker threads
+     * (named like the gpu test, so the HybridSieve can use both)
+     */
+    void fermat_gpu();
+
+  private:
+
+    /* synchronization mutexes */
+    static pthread_mutex_t creation_mutex;
+
+    /* the only instance of this */
+    static CPUFermat *only_instance;
+
+    /* this is a singleton */
+    CPUFermat(unsigned n_threads, 
+              unsigned work_items, 
+              uint64_t n_sieve_primes, 
+              uint64_t n_filter_primes);
+
+    /* the number of candidates tested at once */
+    unsigned n_elements;
+
+    /* the candidates a worker takes at once */
+    unsigned chunk_size;
+
+    /* the gcd pre-filter (NULL if disabled) */
+    GcdFilter *gcd_filter;
+
+    /* number of filtered candidates (in total and at the last log) */
+    volatile uint64_t n_filtered;
+    uint64_t n_filtered_logged;
+
+    /* the buffers */
+    uint32_t *candidates;
+    uint32_t *results;
+    uint32_t prime_base[CPU_FERMAT_OPERAND_SIZE];
+
+    /* the prime base without the lowest 32 bits */
+    mpz_t mpz_base;
+
+    /* the worker threads */
+    pthread_t *threads;
+    unsigned n_threads;
+
+    /* the next candidate to test */
+    volatile unsigned next;
+
+    /* the current run, and the workers still running it */
+    uint64_t run;
+    unsigned n_busy;
+
+    /* synchronization of the runs */
+    pthread_mutex_t run_mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+
+    /* a worker thread */
+    static void *worker_thread(void *args);
+
+    /* the buffers of a worker */
+    typedef struct {
+      FermatBackend *fermat;
+
+      /* the numbers of a chunk */
+      mpz_t *mpz_numbers;
+      bool *composite;
+
+      /* the remaining numbers to test, and there index in the chunk */
+      mpz_ptr *mpz_p;
+      unsigned *index;
+
+      /* the results of the Fermat test */
+      bool *found;
+    } Worker;
+
+    /* tests chunks of the candidates until all are taken */
+    void test_chunks(Worker *worker);
+};
+
+#endif /* __CPU_FERMAT_H__ */
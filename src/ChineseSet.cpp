@@ -25,6 +25,7 @@
 #include <math.h>
 #include "ChineseSet.h"
 #include "utils.h"
+#include "Opts.h"
 
 using namespace std;
 
@@ -86,6 +87,9 @@ ChineseSet::ChineseSet(const char *fname) {
 /* init this */
 void ChineseSet::init() {
 
+  this->sieve_tables      = NULL;
+  this->free_sieve_tables = NULL;
+
   /* generate the primorial */
   for (sieve_t i = 0; i < n_primes; i++)
     mpz_mul_ui(mpz_primorial, mpz_primorial, first_primes[i]);
@@ -95,34 +99,13 @@ void ChineseSet::init() {
   this->bit_size  = mpz_sizeinbase(mpz_primorial, 2);
 
   /* calculate the speed increase */
-  sieve_t avg_count = 0;
   sieve = (sieve_t *) malloc(byte_size);
   this->rand = new_rand128(time(NULL) ^ getpid() ^ n_primes ^ size ^ n_candidates);
+  this->avg_candidates = expected_candidates(first_primes, n_primes, size);
 
-  /** calculate the average candidates per sieve */
-  for (sieve_t i = 0; i < 10000u; i++) {
-    memset(sieve, 0, byte_size);
-
-    /* applay the previous calculated layers */
-    for (sieve_t x = 0; x < n_primes; x++) {
-    
-      const sieve_t index = rand128(this->rand) % first_primes[x];
-      const sieve_t prime = first_primes[x];
-      
-      /* for each posible residue calss creat one sieve */
-      for (sieve_t p = index; p < size; p += prime)
-        set_composite(sieve, p);
-
-    }
-
-    /* count the candidates */
-    sieve_t cur_count = 0;
-    for (sieve_t s = 0; s < byte_size / sizeof(sieve_t); s++)
-      cur_count += popcount(sieve[s]);
+  if (Opts::get_instance()->has_validate_avg())
+    validate_avg_candidates();
 
-    avg_count += cur_count;
-  }
-  this->avg_candidates = size - (((double) avg_count) / 10000);
   memset(this->sieve, 0, byte_size);
 
   /* make offset divisible by two */
@@ -160,6 +143,43 @@ void ChineseSet::init() {
   }
 }
 
+/**
+ * compares the calculated average candidates with the average 
+ * of 10000 randomly sieved windows
+ */
+void ChineseSet::validate_avg_candidates() {
+
+  sieve_t avg_count = 0;
+
+  /** calculate the average candidates per sieve */
+  for (sieve_t i = 0; i < 10000u; i++) {
+    memset(sieve, 0, byte_size);
+
+    /* applay the previous calculated layers */
+    for (sieve_t x = 0; x < n_primes; x++) {
+    
+      const sieve_t index = rand128(this->rand) % first_primes[x];
+      const sieve_t prime = first_primes[x];
+      
+      /* for each posible residue calss creat one sieve */
+      for (sieve_t p = index; p < size; p += prime)
+        set_composite(sieve, p);
+
+    }
+
+    /* count the candidates */
+    sieve_t cur_count = 0;
+    for (sieve_t s = 0; s < byte_size / sizeof(sieve_t); s++)
+      cur_count += popcount(sieve[s]);
+
+    avg_count += cur_count;
+  }
+
+  const double sampled = size - (((double) avg_count) / 10000);
+  log_str("ChineseSet avg_candidates: " + dtoa(avg_candidates) + 
+          " sampled: " + dtoa(sampled), LOG_I);
+}
+
 /* saves this to a file */
 void ChineseSet::save(const char *fname) {
 
@@ -184,6 +204,9 @@ void ChineseSet::save(FILE *file) {
 ChineseSet::~ChineseSet() {
 
   log_str("deleting ChineseSet", LOG_D);
+  if (sieve_tables != NULL)
+    free_sieve_tables(sieve_tables);
+
   free(sieve);
   mpz_clear(mpz_offset);
   mpz_clear(mpz_primorial);
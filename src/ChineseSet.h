@@ -60,6 +60,13 @@ class ChineseSet {
     /* random */
     rand128_t *rand; 
 
+    /**
+     * the read only tables of the ChineseSieves using this,
+     * and the function which frees them when this is deleted
+     */
+    void *sieve_tables;
+    void (*free_sieve_tables)(void *tables);
+
     /* creats a new ChineseSet */
     ChineseSet(sieve_t n_primes, 
                sieve_t size, 
@@ -90,5 +97,8 @@ class ChineseSet {
     /* init this */
     void init();
 
+    /* compares avg_candidates with randomly sieved windows */
+    void validate_avg_candidates();
+
 }; 
 #endif /* __CHINESE_SET_H__ */
@@ -29,18 +29,22 @@
 #include <math.h>
 #include <vector>
 #include <openssl/sha.h>
+/* gcc 12 warns about the _mm512_undefined_epi32() of its own headers */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
 #include "utils.h"
 #include "Opts.h"
 
 using namespace std;
 
-/* compare function to sort by smalest */
-static bool compare_gap_candidate(GapCandidate *a, GapCandidate *b) {
-  return a->n_candidates >= b->n_candidates;
-}
-
 /* stores the found gaps in the form n * primorial, n_candidates */
-vector<GapCandidate *> ChineseSieve::gaps = vector<GapCandidate *>();
+GapQueue *ChineseSieve::gaps = NULL;
+
+/* number of created ChineseSieves (to assign the shards) */
+sieve_t ChineseSieve::n_instances = 0;
 
 /* syncronisation mutex */
 pthread_mutex_t ChineseSieve::mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -54,95 +58,574 @@ uint8_t ChineseSieve::hash_prev_block[SHA256_DIGEST_LENGTH];
 /* the current merit */
 double ChineseSieve::cur_merit = 1.0;
 
+
+/* the gaps for the share thread */
+ChineseSieve::ShareQueue *ChineseSieve::share_queue = NULL;
+
+/* the share thread and its ChineseSieve */
+pthread_t ChineseSieve::share_thread_id;
+ChineseSieve *ChineseSieve::share_sieve = NULL;
+
+/* the order of the Fermat tests within a gap */
+TestOrder *ChineseSieve::test_order = NULL;
+
 /* reste the sieve */
 void ChineseSieve::reset() {
 
   log_str("reset ChineseSieve", LOG_D);
-  pthread_mutex_lock(&mutex);
-  while (!gaps.empty()) {
-    GapCandidate *gap = gaps.back();
-    gaps.pop_back();
-    delete gap;
+  if (gaps != NULL)
+    gaps->clear();
+
+  if (share_queue != NULL)
+    share_queue->clear();
+}
+
+/**
+ * starts the thread which finalizes the shares of all Fermat threads
+ * (it uses an own ChineseSieve for the previous prime search)
+ */
+void ChineseSieve::start_share_thread(PoWProcessor *processor,
+                                      uint64_t n_primes, 
+                                      ChineseSet *cset) {
+
+  if (share_queue != NULL)
+    return;
+
+  log_str("starting the share thread", LOG_D);
+  share_queue = new ShareQueue();
+
+  share_sieve = new ChineseSieve(processor, n_primes, cset);
+  pthread_create(&share_thread_id, NULL, share_thread, (void *) share_sieve);
+}
+
+/**
+ * stops the share thread and waits until it is finished
+ * (the Fermat threads have to be stopped before)
+ */
+void ChineseSieve::stop_share_thread() {
+
+  if (share_queue == NULL)
+    return;
+
+  log_str("stopping the share thread", LOG_D);
+  share_queue->stop();
+  pthread_join(share_thread_id, NULL);
+
+  delete share_sieve;
+  delete share_queue;
+  share_sieve = NULL;
+  share_queue = NULL;
+}
+
+/* the share thread */
+void *ChineseSieve::share_thread(void *args) {
+
+  ChineseSieve *csieve = (ChineseSieve *) args;
+  log_str("share thread started", LOG_D);
+
+  GapCandidate *gap;
+  while ((gap = share_queue->pull()) != NULL) {
+    csieve->process_share(gap);
+    GapArena::release(gap);
   }
-  pthread_mutex_unlock(&mutex);
+
+  log_str("share thread stopped", LOG_D);
+  return NULL;
+}
+
+/* calculates the share of a gap without a prime and submits it if valid */
+void ChineseSieve::process_share(GapCandidate *gap) {
+
+  mpz_t mpz_p, mpz_hash, mpz_gap_start;
+  mpz_init(mpz_p);
+  mpz_init(mpz_hash);
+  mpz_init(mpz_gap_start);
+  
+  /* calculate the adder */
+  gap->get_start(mpz_gap_start);
+  gap_previous_prime(mpz_p, mpz_gap_start, gap);
+  const uint16_t shift = mpz_sizeinbase(mpz_p, 2) - 256;
+  mpz_div_2exp(mpz_hash, mpz_p, shift);
+  mpz_mod_2exp(mpz_p, mpz_p, shift);
+
+  PoW pow(mpz_hash, shift, mpz_p, gap->base->target, gap->base->nonce);
+
+  if (pow.valid()) {
+    if (pprocessor->process(&pow)) {
+      log_str("ShareProcessor requestet reset", LOG_D);
+      ChineseSieve::reset();
+    }
+
+    pthread_mutex_lock(&mutex);
+    gaps_since_share = 0;
+    pthread_mutex_unlock(&mutex);
+  }
+
+  mpz_clear(mpz_p);
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_gap_start);
+}
+
+/**
+ * finds the prime before the start of the given gap
+ *
+ * The left margin of the gap is sieved with the small sieve primes, the 
+ * reminders of the gap start are (base reminder + index * primorial
+ * reminder) % prime, so only a few Fermat tests are needed. Falls back
+ * to mpz_previous_prime if the reminders are unknown or the margin has
+ * no prime.
+ */
+void ChineseSieve::gap_previous_prime(mpz_t mpz_dst, 
+                                      mpz_t mpz_gap_start, 
+                                      GapCandidate *gap) {
+
+  const GapBase *base = gap->base;
+  if (base->reminder == NULL || base->n_reminder > n_primes) {
+    mpz_previous_prime(mpz_dst, mpz_gap_start);
+    return;
+  }
+
+  /* bit d marks gap start - d as composite (the start is even) */
+  sieve_t margin[SHARE_MARGIN / 64];
+  memset(margin, 0, SHARE_MARGIN / 8);
+
+  for (sieve_t i = 1; i < base->n_reminder && primes[i] < SHARE_MARGIN_PRIMES; i++) {
+    const uint64_t prime = primes[i];
+    uint64_t d = ((uint64_t) gap->index) * base->primorial_reminder[i] % prime;
+
+    d += base->reminder[i];
+    if (d >= prime)
+      d -= prime;
+
+    /* first odd d with start - d = 0 mod prime */
+    if ((d & 1) == 0)
+      d += prime;
+
+    for (; d < SHARE_MARGIN; d += 2 * prime)
+      set_composite(margin, d);
+  }
+
+  if (backward_sieve->test_window(mpz_dst, mpz_gap_start, margin, 1, SHARE_MARGIN))
+    return;
+
+  /* search before the margin */
+  mpz_sub_ui(mpz_dst, mpz_gap_start, SHARE_MARGIN);
+  mpz_previous_prime(mpz_dst, mpz_dst);
+}
+
+ChineseSieve::ShareQueue::ShareQueue() {
+  this->stopped = false;
+  pthread_mutex_init(&access_mutex, NULL);
+  pthread_cond_init(&notempty_cond, NULL);
+}
+
+ChineseSieve::ShareQueue::~ShareQueue() {
+  clear();
+  pthread_mutex_destroy(&access_mutex);
+  pthread_cond_destroy(&notempty_cond);
+}
+
+/**
+ * removes the oldest gap (waits if this is empty), 
+ * returns NULL if this was stopped
+ */
+GapCandidate *ChineseSieve::ShareQueue::pull() {
+
+  pthread_mutex_lock(&access_mutex);
+
+  while (q.empty() && !stopped)
+    pthread_cond_wait(&notempty_cond, &access_mutex);
+
+  GapCandidate *gap = NULL;
+  if (!stopped) {
+    gap = q.front();
+    q.pop();
+  }
+
+  pthread_mutex_unlock(&access_mutex);
+  return gap;
+}
+
+/* wakes up and stops all waiting pulls */
+void ChineseSieve::ShareQueue::stop() {
+
+  pthread_mutex_lock(&access_mutex);
+  stopped = true;
+  pthread_cond_broadcast(&notempty_cond);
+  pthread_mutex_unlock(&access_mutex);
+}
+
+/* adds a gap */
+void ChineseSieve::ShareQueue::push(GapCandidate *gap) {
+
+  pthread_mutex_lock(&access_mutex);
+  q.push(gap);
+  pthread_cond_signal(&notempty_cond);
+  pthread_mutex_unlock(&access_mutex);
+}
+
+/* deletes all gaps */
+void ChineseSieve::ShareQueue::clear() {
+
+  pthread_mutex_lock(&access_mutex);
+
+  while (!q.empty()) {
+    GapArena::release(q.front());
+    q.pop();
+  }
+
+  pthread_mutex_unlock(&access_mutex);
+}
+
+/* returns the number of gaps within this */
+size_t ChineseSieve::ShareQueue::size() {
+  return q.size();
 }
 
 /* calculates the primorial reminders */
 void ChineseSieve::calc_primorial_reminder() {
 
   log_str("calculate the primorial reminder", LOG_D);
-  for (sieve_t i = cset->n_primes; i < n_primes; i++) 
-    primorial_reminder[i] = mpz_tdiv_ui(cset->mpz_primorial, primes[i]);
+  for (sieve_t i = 0; i < n_primes; i++) 
+    tables->primorial_reminder[i] = mpz_tdiv_ui(cset->mpz_primorial, primes[i]);
 }
 
-/* calculates the primorial reminders */
-void ChineseSieve::calc_start_reminder() {
+/**
+ * calculates the starts (first odd offset divisible by the prime)
+ * from the reminders, after adding the primorial reminders if step
+ * is not NULL
+ *
+ * start = prime - reminder, plus prime if it is even (this check works 
+ * because mpz_start is divisible by two, and a zero reminder gives prime)
+ */
+static void update_starts_scalar(uint32_t *starts, 
+                                 uint32_t *reminder, 
+                                 const uint32_t *step, 
+                                 const uint32_t *primes, 
+                                 sieve_t n) {
 
-  log_str("calculate the start reminder", LOG_D);
-  for (sieve_t i = cset->n_primes; i < n_primes; i++) {
-    start_reminder[i] = mpz_tdiv_ui(mpz_start, primes[i]);
+  for (sieve_t i = 0; i < n; i++) {
 
-    /* calculate the start */
-    starts[i] = primes[i] - start_reminder[i];
+    /* calculate (start + primorial) % prime */
+    if (step != NULL) {
+      reminder[i] += step[i];
 
-    if (starts[i] == primes[i])
-      starts[i] = 0;
+      if (reminder[i] >= primes[i])
+        reminder[i] -= primes[i];
+    }
 
-    /* is start index divisible by two 
-     * (this check works because mpz_start is divisible by two)
-     */
+    starts[i] = primes[i] - reminder[i];
     if ((starts[i] & 1) == 0)
       starts[i] += primes[i];
   }
 }
 
+/* avx2 version of update_starts_scalar */
+__attribute__((target("avx2")))
+static void update_starts_avx2(uint32_t *starts, 
+                               uint32_t *reminder, 
+                               const uint32_t *step, 
+                               const uint32_t *primes, 
+                               sieve_t n) {
+
+  const __m256i one  = _mm256_set1_epi32(1);
+  const __m256i zero = _mm256_setzero_si256();
+  sieve_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    const __m256i prime = _mm256_loadu_si256((const __m256i *) (primes + i));
+    __m256i rem = _mm256_loadu_si256((const __m256i *) (reminder + i));
+
+    /* min(r, r - p) is (r + step) % p since r < 2p */
+    if (step != NULL) {
+      rem = _mm256_add_epi32(rem, _mm256_loadu_si256((const __m256i *) (step + i)));
+      rem = _mm256_min_epu32(rem, _mm256_sub_epi32(rem, prime));
+      _mm256_storeu_si256((__m256i *) (reminder + i), rem);
+    }
+
+    __m256i start = _mm256_sub_epi32(prime, rem);
+    const __m256i even = _mm256_cmpeq_epi32(_mm256_and_si256(start, one), zero);
+    start = _mm256_add_epi32(start, _mm256_and_si256(even, prime));
+    _mm256_storeu_si256((__m256i *) (starts + i), start);
+  }
+
+  update_starts_scalar(starts + i, 
+                       reminder + i, 
+                       (step != NULL) ? step + i : NULL, 
+                       primes + i, 
+                       n - i);
+}
+
+/* avx512 version of update_starts_scalar */
+__attribute__((target("avx512f")))
+static void update_starts_avx512(uint32_t *starts, 
+                                 uint32_t *reminder, 
+                                 const uint32_t *step, 
+                                 const uint32_t *primes, 
+                                 sieve_t n) {
+
+  const __m512i one = _mm512_set1_epi32(1);
+  sieve_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    const __m512i prime = _mm512_loadu_si512(primes + i);
+    __m512i rem = _mm512_loadu_si512(reminder + i);
+
+    if (step != NULL) {
+      rem = _mm512_add_epi32(rem, _mm512_loadu_si512(step + i));
+      rem = _mm512_min_epu32(rem, _mm512_sub_epi32(rem, prime));
+      _mm512_storeu_si512(reminder + i, rem);
+    }
+
+    __m512i start = _mm512_sub_epi32(prime, rem);
+    start = _mm512_mask_add_epi32(start, 
+                                  _mm512_testn_epi32_mask(start, one), 
+                                  start, 
+                                  prime);
+    _mm512_storeu_si512(starts + i, start);
+  }
+
+  update_starts_scalar(starts + i, 
+                       reminder + i, 
+                       (step != NULL) ? step + i : NULL, 
+                       primes + i, 
+                       n - i);
+}
+
+/* calculates the primorial reminders */
+void ChineseSieve::calc_start_reminder() {
+
+  log_str("calculate the start reminder", LOG_D);
+  for (sieve_t i = cset->n_primes; i < n_primes; i++)
+    start_reminder[i] = mpz_tdiv_ui(mpz_start, primes[i]);
+
+  update_starts(starts32 + cset->n_primes,
+                start_reminder + cset->n_primes,
+                NULL,
+                primes32 + cset->n_primes,
+                n_primes - cset->n_primes);
+}
+
 /* calculates the primorial reminders */
 void ChineseSieve::recalc_starts() {
   
-  for (sieve_t i = cset->n_primes; i < n_primes; i++) {
+  update_starts(starts32 + cset->n_primes,
+                start_reminder + cset->n_primes,
+                primorial_reminder + cset->n_primes,
+                primes32 + cset->n_primes,
+                bucket_start - cset->n_primes);
+}
 
-    /* calculate (start + primorial) % prime */
-    start_reminder[i] += primorial_reminder[i];
+/**
+ * returns the smallest j > 0 with lo <= (j * a) % m <= hi 
+ * (requires gcd(a, m) = 1 and 0 < lo <= hi < m)
+ */
+static uint64_t modulo_search(uint64_t m, uint64_t a, uint64_t lo, uint64_t hi) {
+
+  /* mirror the problem if a is large */
+  if (2 * a > m) {
+    const uint64_t tmp = lo;
+    a  = m - a;
+    lo = m - hi;
+    hi = m - tmp;
+  }
 
-    /* start % prime */
-    if (start_reminder[i] >= primes[i])
-      start_reminder[i] -= primes[i];
-      
+  /* first multiple of a without a wrap around */
+  const uint64_t j = (lo + a - 1) / a;
+  if (j * a <= hi)
+    return j;
 
-    /* calculate the start */
-    starts[i] = primes[i] - start_reminder[i];
+  /* search the number of wrap arounds k (reduced problem modulo a) */
+  const uint64_t k = modulo_search(a, a - m % a, lo % a, hi % a);
+  return (lo + m * k + a - 1) / a;
+}
 
-    if (starts[i] == primes[i])
-      starts[i] = 0;
+/* returns the smallest j >= 0 with (f + j * step) % prime < h */
+static uint64_t next_hit(uint64_t prime, uint64_t step, uint64_t f, uint64_t h) {
+  
+  if (f < h)
+    return 0;
 
-    /* is start index divisible by two 
-     * (this check works because mpz_start is divisible by two)
-     */
-    if ((starts[i] & 1) == 0)
-      starts[i] += primes[i];
+  return modulo_search(prime, step, prime - f, prime - f + h - 1);
+}
+
+/* calculates the bucket constants */
+void ChineseSieve::calc_bucket_primes() {
+
+  log_str("calculate the bucket constants", LOG_D);
+
+  /* primes which can hit a gap at most once */
+  const sieve_t size = cset->byte_size * 8;
+  const uint64_t h   = size / 2;
+
+  sieve_t start = cset->n_primes;
+  while (start < n_primes && primes[start] < size)
+    start++;
+
+  tables->bucket_start  = start;
+  tables->bucket_primes = (BucketPrime *) malloc(sizeof(BucketPrime) * (n_primes - start + 1));
+  for (sieve_t i = start; i < n_primes; i++) {
+
+    const uint64_t prime = primes[i];
+    BucketPrime *bp = tables->bucket_primes + (i - start);
+
+    /* (primorial / 2) % prime */
+    uint64_t half = tables->primorial_reminder[i];
+    half = (half & 1) ? (half + prime) / 2 : half / 2;
+
+    bp->step       = prime - half;
+    bp->jump_up    = modulo_search(prime, bp->step, 1, h - 1);
+    bp->shift_up   = (bp->jump_up * (uint64_t) bp->step) % prime;
+    bp->jump_down  = modulo_search(prime, bp->step, prime - h + 1, prime - 1);
+    bp->shift_down = prime - (bp->jump_down * (uint64_t) bp->step) % prime;
+  }
+}
+
+/* adds a hit (f) of prime index i jump gaps after the given gap */
+inline void ChineseSieve::bucket_add(sieve_t i, 
+                                     uint64_t gap, 
+                                     uint64_t jump, 
+                                     uint32_t f) {
+
+  BucketEntry entry;
+  entry.index  = i;
+  entry.offset = 2 * f + 1;
+
+  /* park the prime within the last bucket */
+  if (jump >= n_buckets) {
+    bucket_pending[i - bucket_start] = f;
+    entry.index  |= BUCKET_FAR;
+    entry.offset  = jump - (n_buckets - 1);
+    jump          = n_buckets - 1;
+  }
+
+  BucketChunk **bucket = buckets + ((gap + jump) & (n_buckets - 1));
+  if (*bucket == NULL || (*bucket)->size == BUCKET_CHUNK_SIZE) {
+    
+    BucketChunk *chunk = free_chunks;
+    if (chunk != NULL) {
+      free_chunks = chunk->next;
+    } else {
+      chunk = (BucketChunk *) malloc(sizeof(BucketChunk));
+      chunks.push_back(chunk);
+    }
+
+    chunk->next = *bucket;
+    chunk->size = 0;
+    *bucket     = chunk;
+  }
+
+  (*bucket)->entries[(*bucket)->size++] = entry;
+}
+
+/* puts all bucket sieved primes into the bucket of there first hit */
+void ChineseSieve::init_buckets() {
+
+  /* recycle all chunks */
+  for (sieve_t b = 0; b < n_buckets; b++) {
+    while (buckets[b] != NULL) {
+      BucketChunk *chunk = buckets[b];
+      buckets[b]  = chunk->next;
+      chunk->next = free_chunks;
+      free_chunks = chunk;
+    }
+  }
+
+  const uint64_t h = (cset->byte_size * 8) / 2;
+  for (sieve_t i = bucket_start; i < n_primes; i++) {
+
+    const uint64_t prime = primes[i];
+    const uint64_t step  = bucket_primes[i - bucket_start].step;
+
+    /* first odd offset 2f + 1 with start + 2f + 1 = 0 mod prime */
+    uint64_t f = prime - 1 - start_reminder[i];
+    f = (f & 1) ? (f + prime) / 2 : f / 2;
+
+    const uint64_t jump = next_hit(prime, step, f, h);
+    bucket_add(i, 0, jump, (f + (jump % prime) * step) % prime);
   }
 }
 
 /**
- * Fermat pseudo prime test
+ * sieves the hits of all bucket sieved primes within the given gap
+ * (into the batch sieve with the given gap bit if batch is not NULL)
  */
-inline bool ChineseSieve::fermat_test(mpz_t mpz_p) {
+inline void ChineseSieve::bucket_sieve(uint64_t gap, sieve_t *batch, sieve_t bit) {
+
+  const uint32_t h = (cset->byte_size * 8) / 2;
+  BucketChunk **bucket = buckets + (gap & (n_buckets - 1));
+  BucketChunk *chunk = *bucket;
+  *bucket = NULL;
+
+  while (chunk != NULL) {
+    for (uint32_t e = 0; e < chunk->size; e++) {
+      const BucketEntry entry = chunk->entries[e];
+
+      /* prime was parked, its hit is still pending */
+      if (entry.index & BUCKET_FAR) {
+        const sieve_t i = entry.index & ~BUCKET_FAR;
+        bucket_add(i, gap, entry.offset, bucket_pending[i - bucket_start]);
+        continue;
+      }
 
-  /* tmp = p - 1 */
-  mpz_sub_ui(mpz_e, mpz_p, 1);
+      if (batch == NULL)
+        set_composite(sieve, entry.offset);
+      else
+        batch[entry.offset >> 1] |= bit;
+
+      /* find the next hit */
+      const BucketPrime *bp = bucket_primes + (entry.index - bucket_start);
+      const uint32_t f = entry.offset >> 1;
+      const bool up    = f + bp->shift_up < h;
+      const bool down  = f >= bp->shift_down;
+
+      if (up && (!down || bp->jump_up < bp->jump_down))
+        bucket_add(entry.index, gap, bp->jump_up, f + bp->shift_up);
+      else if (down)
+        bucket_add(entry.index, gap, bp->jump_down, f - bp->shift_down);
+      else
+        bucket_add(entry.index, 
+                   gap, 
+                   bp->jump_up + bp->jump_down, 
+                   f + bp->shift_up - bp->shift_down);
+    }
 
-  /* res = 2^tmp mod p */
-  mpz_powm(mpz_r, mpz_two, mpz_e, mpz_p);
+    BucketChunk *next = chunk->next;
+    chunk->next = free_chunks;
+    free_chunks = chunk;
+    chunk       = next;
+  }
+}
 
-  if (mpz_cmp_ui(mpz_r, 1) == 0)
-    return true;
+/**
+ * Fermat pseudo prime test
+ */
+inline bool ChineseSieve::fermat_test(mpz_t mpz_p) {
 
-  return false;
+  bool result;
+  single_fermat->fermat_test(&mpz_p, &result, 1);
+
+  return result;
 }
 
 /* calculate the avg sieve candidates */
 void ChineseSieve::calc_avg_prime_candidates() {
 
+  this->avg_prime_candidates = expected_candidates(primes, n_primes, sievesize);
+  log_str("avg_prime_candidates: " + itoa(this->avg_prime_candidates), LOG_D);
+
+  if (Opts::get_instance()->has_validate_avg())
+    validate_avg_prime_candidates();
+
+  this->crt_status = 100.0;
+}
+
+/**
+ * compares avg_prime_candidates with the average of 1000 randomly 
+ * sieved windows
+ */
+void ChineseSieve::validate_avg_prime_candidates() {
+
   sieve_t avg_count = 0;
 
   /** calculate the average candidates per sieve */
@@ -150,7 +633,7 @@ void ChineseSieve::calc_avg_prime_candidates() {
 
     memset(sieve, 0, sievesize / 8);
     this->crt_status = i / 10.0;
-    log_str("init CRT " + itoa(i) + " / " + itoa(1000u), LOG_I);
+    log_str("validate CRT " + itoa(i) + " / " + itoa(1000u), LOG_I);
 
     for (sieve_t x = 0; x < n_primes; x++) {
     
@@ -163,14 +646,13 @@ void ChineseSieve::calc_avg_prime_candidates() {
 
     /* count the candidates */
     for (sieve_t s = 0; s < sievesize; s++)
-  	  if (is_prime(sieve, s)) 
+      if (is_prime(sieve, s)) 
         avg_count++;
-	
   }
-  this->crt_status = 100.0;
-  
-  this->avg_prime_candidates = (((double) avg_count) / 1000);
-  log_str("avg_prime_candidates: " + itoa(this->avg_prime_candidates), LOG_D);
+
+  const double sampled = ((double) avg_count) / 1000;
+  log_str("avg_prime_candidates: " + dtoa(avg_prime_candidates) + 
+          " sampled: " + dtoa(sampled), LOG_I);
 }
 
 /* returns the theoreticaly speed increas factor for a given merit */
@@ -192,19 +674,128 @@ ChineseSieve::ChineseSieve(PoWProcessor *processor,
 
   this->n_primes             = n_primes;
   this->cset                 = cset;
-  this->primorial_reminder   = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
-  this->start_reminder       = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
-  this->starts               = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
+  this->start_reminder       = (uint32_t *) malloc(sizeof(uint32_t) * n_primes);
+  this->starts32             = (uint32_t *) malloc(sizeof(uint32_t) * n_primes);
   this->sievesize            = cset->size;
   this->avg_prime_candidates = 0.0;
   this->crt_status           = 0.000001;
   this->cur_merit            = 1.0;
   this->rand = new_rand128(time(NULL) ^ getpid() ^ n_primes ^ sievesize);
+  this->use_buckets          = Opts::get_instance()->has_bucket_sieve();
+  this->n_buckets            = 1024;
+  this->bucket_pending       = NULL;
+  this->buckets              = NULL;
+  this->free_chunks          = NULL;
+  this->candidates           = (uint32_t *) malloc(sizeof(uint32_t) * (cset->byte_size * 4 + 1));
+  this->sort_keys            = (uint64_t *) malloc(sizeof(uint64_t) * (cset->byte_size * 4 + 1));
+  this->arena                = new GapArena();
+  this->base                 = NULL;
+  this->base_gap             = 0;
+  this->use_batches          = Opts::get_instance()->has_batch_sieve();
+  this->batch                = NULL;
+  this->cutoff_factor        = 0.0;
+  this->cutoff               = UINT32_MAX;
+  this->sum_candidates       = 0.0;
+  this->sum_gaps             = 0;
+
+  if (Opts::get_instance()->has_sieve_cutoff())
+    this->cutoff_factor = atof(Opts::get_instance()->get_sieve_cutoff().c_str());
+
+  this->heap_median  = 0;
+  this->n_deep       = 0;
+  this->deep_starts  = NULL;
+  this->deep_sieve   = NULL;
+
+  if (Opts::get_instance()->has_deep_primes())
+    this->n_deep = atoll(Opts::get_instance()->get_deep_primes().c_str());
+
+  /* the first ChineseSieve of a ChineseSet calculates the tables for all */
+  pthread_mutex_lock(&mutex);
+  this->tables = (ChineseTables *) cset->sieve_tables;
+  while (tables != NULL && tables->n_primes != n_primes)
+    tables = tables->next;
+
+  if (tables == NULL) {
+    calc_tables();
+    tables->next            = (ChineseTables *) cset->sieve_tables;
+    cset->sieve_tables      = tables;
+    cset->free_sieve_tables = free_tables;
+  }
+  
+  /* one queue shard per Fermat thread */
+  if (gaps == NULL) {
+    Opts *opts = Opts::get_instance();
+    sieve_t n_shards = 1;
+    if (opts->has_fermat_threads())
+      n_shards = atoi(opts->get_fermat_threads().c_str());
+
+    uint64_t max_bytes = 0;
+    if (opts->has_queue_memory())
+      max_bytes = atoll(opts->get_queue_memory().c_str()) << 20;
+
+    gaps = new GapQueue(n_shards, 
+                        cset->byte_size * 4, 
+                        max_bytes, 
+                        opts->has_queue_evict());
+  }
+  this->shard = n_instances++ % gaps->get_n_shards();
+
+  if (test_order == NULL) {
+    Opts *opts = Opts::get_instance();
+    test_order = new TestOrder(opts->has_test_order() ? 
+                               opts->get_test_order().c_str() : 
+                               "ascending",
+                               cset->size);
+  }
+  pthread_mutex_unlock(&mutex);
 
-  mpz_init(this->mpz_e);
-  mpz_init(this->mpz_r);
-  mpz_init_set_ui64(this->mpz_two, 2);
-  calc_primorial_reminder();
+  this->primorial_reminder = tables->primorial_reminder;
+  this->primes32           = tables->primes32;
+  this->bucket_start       = tables->bucket_start;
+  this->bucket_primes      = tables->bucket_primes;
+  this->cutoff_index       = tables->cutoff_index;
+  this->cutoff_ratio       = tables->cutoff_ratio;
+  this->deep_primes        = tables->deep_primes;
+  this->deep_steps         = tables->deep_steps;
+  this->deep_inverse       = tables->deep_inverse;
+
+  /* the sieve depth of the gaps (for there scores) */
+  this->log_depth      = log(primes[n_primes - 1]);
+  this->log_deep_depth = (n_deep > 0) ? log(deep_primes[n_deep - 1]) : log_depth;
+
+  /* select the fastest residue update kernel */
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    log_str("using avx512 residue updates", LOG_D);
+    this->update_starts = update_starts_avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    log_str("using avx2 residue updates", LOG_D);
+    this->update_starts = update_starts_avx2;
+  } else
+    this->update_starts = update_starts_scalar;
+
+  /* the fastest Fermat tests for the mined bit width */
+  const sieve_t bits = 256 + (Opts::get_instance()->has_shift() ? 
+                              atoi(Opts::get_instance()->get_shift().c_str()) : 25);
+  this->single_fermat = FermatBackend::create_fastest(bits, false);
+  this->batch_fermat  = FermatBackend::create_fastest(bits, true);
+  log_str("using the " + string(single_fermat->get_name()) + " and " + 
+          batch_fermat->get_name() + " Fermat tests", LOG_D);
+
+  this->backward_sieve = new BackwardSieve(primes, n_primes, batch_fermat);
+
+  if (use_buckets) {
+    this->bucket_pending = (uint32_t *) malloc(sizeof(uint32_t) * (n_primes - bucket_start + 1));
+    this->buckets        = (BucketChunk **) calloc(n_buckets, sizeof(BucketChunk *));
+  }
+
+  if (n_deep > 0) {
+    this->deep_starts = (uint32_t *) malloc(sizeof(uint32_t) * n_deep);
+    this->deep_sieve  = (sieve_t *) malloc(bound(cset->byte_size * 4, 64) / 8);
+  }
+
+  if (use_batches)
+    this->batch = (sieve_t *) calloc(cset->byte_size * 4, sizeof(sieve_t));
 
   this->max_merit = sievesize / ((atoi(Opts::get_instance()->get_shift().c_str()) + 256) * log(2));
 
@@ -213,6 +804,74 @@ ChineseSieve::ChineseSieve(PoWProcessor *processor,
       " with " + itoa(cset->n_candidates) + " prime candidates", LOG_D);
 }
 
+/**
+ * calculates the shared tables for this, they are freed with 
+ * the ChineseSet since other ChineseSieves may still use them
+ */
+void ChineseSieve::calc_tables() {
+
+  log_str("calculate the shared ChineseSieve tables", LOG_D);
+  this->tables                     = new ChineseTables();
+  this->tables->n_primes           = n_primes;
+  this->tables->next               = NULL;
+  this->tables->primorial_reminder = (uint32_t *) malloc(sizeof(uint32_t) * n_primes);
+  this->tables->primes32           = (uint32_t *) malloc(sizeof(uint32_t) * n_primes);
+  this->tables->bucket_start       = n_primes;
+  this->tables->bucket_primes      = NULL;
+  this->tables->deep_primes        = NULL;
+  this->tables->deep_steps         = NULL;
+  this->tables->deep_inverse       = NULL;
+
+  for (sieve_t i = 0; i < n_primes; i++)
+    tables->primes32[i] = primes[i];
+
+  calc_primorial_reminder();
+
+  if (use_buckets)
+    calc_bucket_primes();
+
+  /**
+   * the early cutoff check is done after all primes which can hit a gap
+   * more than once, the remaining primes leave about 
+   * ln(checked prime) / ln(max prime) of the candidates (Mertens)
+   */
+  sieve_t index = cset->n_primes;
+  while (index < n_primes && primes[index] < cset->byte_size * 8)
+    index++;
+
+  tables->cutoff_index = index;
+  tables->cutoff_ratio = 1.0;
+  if (index > cset->n_primes && index < n_primes)
+    tables->cutoff_ratio = log(primes[index - 1]) / log(primes[n_primes - 1]);
+
+  if (n_deep > 0)
+    calc_deep_primes();
+
+  if (use_batches)
+    for (uint32_t i = 1; i < cset->byte_size * 8; i += 2)
+      if (is_prime(cset->sieve, i))
+        tables->set_candidates.push_back(i);
+}
+
+/* frees the given tables (called by the ChineseSet) */
+void ChineseSieve::free_tables(void *tables) {
+
+  ChineseTables *cur = (ChineseTables *) tables;
+  while (cur != NULL) {
+    ChineseTables *next = cur->next;
+
+    free(cur->primorial_reminder);
+    free(cur->primes32);
+    free(cur->bucket_primes);
+    free(cur->deep_primes);
+    free(cur->deep_steps);
+    free(cur->deep_inverse);
+    delete cur;
+
+    cur = next;
+  }
+}
+
 /* check if we should stop sieving */
 bool ChineseSieve::should_stop(uint8_t hash[SHA256_DIGEST_LENGTH]) {
 
@@ -287,40 +946,116 @@ void ChineseSieve::run_sieve(PoW *pow, uint8_t hash[SHA256_DIGEST_LENGTH]) {
 
   calc_start_reminder();
 
+  if (use_buckets)
+    init_buckets();
+
+  if (n_deep > 0)
+    calc_deep_starts();
+
   sieve_t sievesize = bound(pow->target_size(mpz_start), 8);
   sievesize = (sievesize > cset->byte_size * 8) ? cset->size : sievesize;
+
+  /* the gaps only store there index after the base start */
+  base     = new GapBase(pow->get_nonce(), 
+                         pow->get_target(), 
+                         mpz_start, 
+                         cset->mpz_primorial);
+  base_gap = start;
+
+  /* the start reminders let the share thread sieve the left margins */
+  base->reminder           = (uint32_t *) malloc(sizeof(uint32_t) * n_primes);
+  base->primorial_reminder = primorial_reminder;
+  base->n_reminder         = n_primes;
+
+  for (sieve_t i = 0; i < cset->n_primes; i++)
+    base->reminder[i] = mpz_tdiv_ui(mpz_start, primes[i]);
+
+  memcpy(base->reminder + cset->n_primes, 
+         start_reminder + cset->n_primes, 
+         sizeof(uint32_t) * (n_primes - cset->n_primes));
+
+  /* the gaps are ranked by there valid probability for the current target */
+  base->log_start = mpz_log(mpz_start);
+  base->sievesize = sievesize;
+  gaps->set_target(pow->get_target());
+
   log_str("init time: " + itoa(PoWUtils::gettime_usec() - time) + "us", LOG_D);
   log_str("sievesize: " + itoa(sievesize), LOG_D);
 
 
+  if (use_batches) {
+    sum_candidates = 0.0;
+    sum_gaps       = 0;
+
+    for (uint64_t cur_gap = start; cur_gap < end && !should_stop(hash); cur_gap += 64) {
+      publish_gaps(hash);
+      calc_cutoff();
+      sieve_batch(cur_gap, (end - cur_gap < 64) ? end - cur_gap : 64, sievesize);
+    }
+
+    publish_gaps(hash);
+    base->release();
+    log_str("run_sieve finished", LOG_D);
+    return;
+  }
+
+  sum_candidates = 0.0;
+  sum_gaps       = 0;
+
   for (uint64_t cur_gap = start; cur_gap < end && !should_stop(hash); cur_gap++) {
 
+    if (cur_gap % 64 == 0) {
+      publish_gaps(hash);
+      calc_cutoff();
+    }
+
    /* reinit the sieve */
     memcpy(sieve, cset->sieve, sievesize / 8);
  
     /* sieve all small primes (skip all primes within the set) */
-    for (sieve_t i = cset->n_primes; i < n_primes; i++) {
+    for (sieve_t i = cset->n_primes; i < cutoff_index; i++) {
  
       /**
        * sieve all odd multiplies of the current prime
        */
-      for (sieve_t p = starts[i]; p < sievesize; p += primes2[i])
+      for (sieve_t p = starts32[i]; p < sievesize; p += primes2[i])
         set_composite(sieve, p);
     }
 
-    /* collect the prime candidates */
-    vector<uint32_t> candidates;
-    for (uint32_t i = 1; i < sievesize; i += 2)
-      if (is_prime(sieve, i))
-        candidates.push_back(i);
+    /* drop the gap early if the expected candidates are above the cutoff */
+    bool hopeless = false;
+    if (cutoff_factor >= 1.0) {
+      const double expected = count_candidates(sieve, 1, sievesize) * cutoff_ratio;
 
-    /* save the gap */
-    GapCandidate *gap = new GapCandidate(pow->get_nonce(), pow->get_target(), mpz_start, candidates);
-    pthread_mutex_lock(&mutex);
+      sum_candidates += expected;
+      sum_gaps++;
+      hopeless = (expected > cutoff);
+    }
 
-    gaps.push_back(gap);
-    push_heap(gaps.begin(), gaps.end(), compare_gap_candidate);
-    pthread_mutex_unlock(&mutex);
+    /* sieve the remaining primes */
+    for (sieve_t i = cutoff_index; i < bucket_start && !hopeless; i++) {
+      for (sieve_t p = starts32[i]; p < sievesize; p += primes2[i])
+        set_composite(sieve, p);
+    }
+
+    /* sieve the large primes which hit this gap */
+    if (use_buckets)
+      bucket_sieve(cur_gap, NULL, 0);
+
+    if (!hopeless) {
+
+      /* collect the prime candidates */
+      uint32_t n_candidates = extract_candidates(sieve, 1, sievesize, 0, candidates);
+
+      /* sieve promising gaps with the deep primes */
+      const bool deep = (n_deep > 0 && n_candidates < heap_median);
+      if (deep)
+        n_candidates = sieve_deep(cur_gap, candidates, n_candidates, sievesize);
+     
+      /* save the gap */
+      if (n_candidates <= cutoff)
+        add_gap(cur_gap, candidates, n_candidates, deep);
+    }
 
     mpz_add(mpz_start, mpz_start, cset->mpz_primorial);
 
@@ -328,21 +1063,322 @@ void ChineseSieve::run_sieve(PoW *pow, uint8_t hash[SHA256_DIGEST_LENGTH]) {
     recalc_starts();
   }
 
+  publish_gaps(hash);
+  base->release();
   log_str("run_sieve finished", LOG_D);
 }
 
+/**
+ * saves a sieved gap (in new_gaps until they are published),
+ * mpz_start has to be the start of the given gap
+ */
+void ChineseSieve::add_gap(uint64_t gap, 
+                           const uint32_t *candidates, 
+                           uint32_t n_candidates,
+                           bool deep) {
+
+  /* the gap index is 32 bit, so start a new base after 2^32 gaps */
+  if (gap - base_gap > UINT32_MAX) {
+    GapBase *next = new GapBase(base->nonce, 
+                                base->target, 
+                                mpz_start, 
+                                cset->mpz_primorial);
+    next->log_start = base->log_start;
+    next->sievesize = base->sievesize;
+
+    base->release();
+    base     = next;
+    base_gap = gap;
+  }
+
+  GapCandidate *gap_candidate = arena->alloc(base, 
+                                             gap - base_gap, 
+                                             candidates, 
+                                             n_candidates);
+
+  gap_candidate->log_depth = deep ? log_deep_depth : log_depth;
+  new_gaps.push_back(gap_candidate);
+}
+
+/**
+ * publishes the new gaps, or deletes them if they are outdated
+ * (waits while the gap queue is full)
+ */
+void ChineseSieve::publish_gaps(uint8_t hash[SHA256_DIGEST_LENGTH]) {
+
+  while (gaps->full() && running && !should_stop(hash))
+    gaps->wait_not_full();
+
+  if (!running || should_stop(hash)) {
+    for (sieve_t i = 0; i < new_gaps.size(); i++)
+      GapArena::release(new_gaps[i]);
+
+    new_gaps.clear();
+  } else
+    gaps->push(new_gaps);
+}
+
+/**
+ * recalculates the cutoff and median from the heap distribution
+ *
+ * a gap with n candidates is about exp((n - median) * merit / avg)
+ * times less likely to be valid than the median gap in the heap,
+ * the cutoff is only used if there are enough gaps waiting for
+ * the Fermat threads
+ */
+void ChineseSieve::calc_cutoff() {
+
+  cutoff      = UINT32_MAX;
+  heap_median = 0;
+  if (cutoff_factor < 1.0 && n_deep == 0)
+    return;
+
+  heap_median = gaps->median();
+
+  if (cutoff_factor >= 1.0 && sum_gaps > 0 && gaps->size() >= CUTOFF_MIN_GAPS) {
+    const double avg = sum_candidates / sum_gaps;
+    cutoff = heap_median + avg * log(cutoff_factor) / cur_merit;
+  }
+}
+
+/* generates the deep primes (the n_deep primes following the sieve primes) */
+void ChineseSieve::calc_deep_primes() {
+
+  log_str("generating " + itoa(n_deep) + " deep primes", LOG_D);
+  tables->deep_primes  = (uint32_t *) malloc(sizeof(uint32_t) * n_deep);
+  tables->deep_steps   = (uint32_t *) malloc(sizeof(uint32_t) * n_deep);
+  tables->deep_inverse = (double *)   malloc(sizeof(double) * n_deep);
+
+  /* upper bound of the n'th prime: n * (ln(n) + ln(ln(n))) */
+  const double n = n_primes + n_deep + 6;
+  const sieve_t max_prime = n * (log(n) + log(log(n)));
+  const sieve_t max_base  = sqrt((double) max_prime) + 1;
+
+  /* odd base primes to sieve the segments */
+  vector<bool> composite(max_base + 1, false);
+  vector<sieve_t> base;
+  for (sieve_t i = 3; i <= max_base; i += 2) {
+    if (!composite[i]) {
+      base.push_back(i);
+      for (sieve_t p = i * i; p <= max_base; p += 2 * i)
+        composite[p] = true;
+    }
+  }
+
+  /* segmented sieve of the odd numbers after the largest sieve prime */
+  const sieve_t segment_size = 1 << 18;
+  vector<bool> segment(segment_size);
+  sieve_t n_found = 0;
+  for (sieve_t low = primes[n_primes - 1] + 2; n_found < n_deep; low += 2 * segment_size) {
+
+    fill(segment.begin(), segment.end(), false);
+    for (sieve_t i = 0; i < base.size() && base[i] * base[i] < low + 2 * segment_size; i++) {
+      const sieve_t prime = base[i];
+
+      /* first odd multiple >= max(low, prime^2) */
+      sieve_t first = (low + prime - 1) / prime * prime;
+      if ((first & 1) == 0)
+        first += prime;
+      if (first < prime * prime)
+        first = prime * prime;
+
+      for (sieve_t p = (first - low) / 2; p < segment_size; p += prime)
+        segment[p] = true;
+    }
+
+    for (sieve_t i = 0; i < segment_size && n_found < n_deep; i++)
+      if (!segment[i])
+        tables->deep_primes[n_found++] = low + 2 * i;
+  }
+
+  for (sieve_t i = 0; i < n_deep; i++) {
+    const uint64_t prime = tables->deep_primes[i];
+
+    /* (primorial / 2) % prime */
+    uint64_t half = mpz_tdiv_ui(cset->mpz_primorial, prime);
+    half = (half & 1) ? (half + prime) / 2 : half / 2;
+
+    tables->deep_steps[i]   = prime - half;
+    tables->deep_inverse[i] = 1.0 / prime;
+  }
+}
+
+/* calculates the deep starts for the current start */
+void ChineseSieve::calc_deep_starts() {
+
+  for (sieve_t i = 0; i < n_deep; i++) {
+    const uint64_t prime = deep_primes[i];
+
+    /* first odd offset 2f + 1 with start + 2f + 1 = 0 mod prime */
+    uint64_t f = prime - 1 - mpz_tdiv_ui(mpz_start, prime);
+    deep_starts[i] = (f & 1) ? (f + prime) / 2 : f / 2;
+  }
+}
+
+/**
+ * removes all candidates of the given gap which are divisible by a
+ * deep prime, and returns the new number of candidates
+ *
+ * the hit of gap k is (start + k * step) % prime, the quotient is
+ * estimated with a double multiplication, which is off by at most
+ * one for k < 2^32
+ */
+uint32_t ChineseSieve::sieve_deep(uint64_t gap,
+                                  uint32_t *candidates,
+                                  uint32_t n_candidates,
+                                  sieve_t sievesize) {
+
+  const sieve_t h = sievesize / 2;
+  memset(deep_sieve, 0, bound(h, 64) / 8);
+
+  for (sieve_t i = 0; i < n_deep; i++) {
+    const int64_t prime = deep_primes[i];
+    const uint64_t k    = (gap > UINT32_MAX) ? gap % prime : gap;
+    const uint64_t m    = k * deep_steps[i];
+
+    int64_t f = m - ((uint64_t) (m * deep_inverse[i])) * prime;
+    f += deep_starts[i];
+
+    if (f < 0)
+      f += prime;
+    else if (f >= prime)
+      f -= prime;
+    if (f >= prime)
+      f -= prime;
+
+    for (sieve_t p = f; p < h; p += prime)
+      set_composite(deep_sieve, p);
+  }
+
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < n_candidates; i++)
+    if (is_prime(deep_sieve, candidates[i] >> 1))
+      candidates[n++] = candidates[i];
+
+  return n;
+}
+
+/** 
+ * sieves the next n_gaps (<= 64) gaps at once
+ *
+ * The batch sieve is transposed: it has one word per odd offset and 
+ * bit j of it belongs to gap + j. So the reminders of each prime
+ * stay in registers for the whole batch, and only the ChineseSet
+ * candidates have to be cleared and checked.
+ */
+void ChineseSieve::sieve_batch(uint64_t gap, 
+                               uint64_t n_gaps, 
+                               sieve_t sievesize) {
+
+  /* sieve all small primes (skip all primes within the set) */
+  for (sieve_t i = cset->n_primes; i < bucket_start; i++) {
+
+    const sieve_t prime  = primes[i];
+    const sieve_t prime2 = primes2[i];
+    const sieve_t step   = primorial_reminder[i];
+    sieve_t reminder     = start_reminder[i];
+
+    for (sieve_t j = 0; j < n_gaps; j++) {
+      
+      /* (start + 2 * prime * x + first) % prime == 0 and first is odd */
+      sieve_t first = prime - reminder;
+      if (first == prime)
+        first = 0;
+      if ((first & 1) == 0)
+        first += prime;
+
+      const sieve_t bit = ((sieve_t) 1) << j;
+      for (sieve_t p = first; p < sievesize; p += prime2)
+        batch[p >> 1] |= bit;
+
+      /* calculate (start + primorial) % prime */
+      reminder += step;
+      if (reminder >= prime)
+        reminder -= prime;
+    }
+    start_reminder[i] = reminder;
+  }
+
+  /* sieve the large primes */
+  if (use_buckets)
+    for (sieve_t j = 0; j < n_gaps; j++)
+      bucket_sieve(gap + j, batch, ((sieve_t) 1) << j);
+
+  /* collect the prime candidates and clear the batch sieve */
+  const sieve_t mask = (n_gaps == 64) ? ~((sieve_t) 0) : (((sieve_t) 1) << n_gaps) - 1;
+  const vector<uint32_t> &set_candidates = tables->set_candidates;
+  sieve_t i;
+  for (i = 0; i < set_candidates.size() && set_candidates[i] < sievesize; i++) {
+
+    const uint32_t offset = set_candidates[i];
+    sieve_t word = ~batch[offset >> 1] & mask;
+    batch[offset >> 1] = 0;
+
+    while (word) {
+      batch_candidates[__builtin_ctzll(word)].push_back(offset);
+      word &= word - 1;
+    }
+  }
+
+  /**
+   * the bucket primes hit the whole ChineseSet, so the words above the 
+   * sievesize have to be cleared too (a later target can increase it)
+   */
+  if (use_buckets)
+    for (; i < set_candidates.size(); i++)
+      batch[set_candidates[i] >> 1] = 0;
+
+  /* save the gaps */
+  for (sieve_t j = 0; j < n_gaps; j++) {
+    
+    sum_candidates += batch_candidates[j].size();
+    sum_gaps++;
+
+    /* sieve promising gaps with the deep primes */
+    const bool deep = (n_deep > 0 && batch_candidates[j].size() < heap_median);
+    if (deep)
+      batch_candidates[j].resize(sieve_deep(gap + j, 
+                                            batch_candidates[j].data(), 
+                                            batch_candidates[j].size(), 
+                                            sievesize));
+
+    if (batch_candidates[j].size() <= cutoff)
+      add_gap(gap + j, 
+              batch_candidates[j].data(), 
+              batch_candidates[j].size(), 
+              deep);
+
+    batch_candidates[j].clear();
+    mpz_add(mpz_start, mpz_start, cset->mpz_primorial);
+  }
+}
+
+
 /** 
  * runn the sieve with a list of gaps and store all found candidates
+ * (while running is true)
  */
-void ChineseSieve::run_fermat() {
+void ChineseSieve::run_fermat(bool *running) {
 
   if (avg_prime_candidates < 1.0)
     calc_avg_prime_candidates();
   
   log_str("run_fermat", LOG_D);
-  mpz_t mpz_p, mpz_hash;
-  mpz_init(mpz_p);
-  mpz_init(mpz_hash);
+
+  /* one gap per lane of the Fermat test (no backend has more than the simd test) */
+  const sieve_t n_lanes = min(batch_fermat->get_lanes(), (sieve_t) SIMD_FERMAT_LANES);
+  FermatLane lanes[SIMD_FERMAT_LANES];
+  mpz_ptr mpz_lane_p[SIMD_FERMAT_LANES];
+  sieve_t lane_index[SIMD_FERMAT_LANES];
+  bool results[SIMD_FERMAT_LANES];
+
+  for (sieve_t l = 0; l < n_lanes; l++) {
+    lanes[l].gap        = NULL;
+    lanes[l].candidates = (l == 0) ? candidates : 
+                          (uint32_t *) malloc(sizeof(uint32_t) * (cset->byte_size * 4 + 1));
+    mpz_init(lanes[l].mpz_start);
+    mpz_init(lanes[l].mpz_p);
+  }
 
   sieve_t shift    = atoi(Opts::get_instance()->get_shift().c_str());
   sieve_t interval = (25L * 1000LL * 1000LL) / (shift * shift);
@@ -351,86 +1387,229 @@ void ChineseSieve::run_fermat() {
   double log_start = 0.0;
   sieve_t speed_factor = 0;
   uint64_t time = PoWUtils::gettime_usec();
+  sieve_t n_active = 0;
 
-  for (;;) {
-    index++;
+  /* wait_pop returns after a timeout, so running is rechecked */
+  while (*running) {
 
-    /* get the next best GapCandidate */
-    pthread_mutex_lock(&mutex);
+    /* fill the empty lanes (only wait for a gap if all are empty) */
+    for (sieve_t l = 0; l < n_lanes; l++) {
+      if (lanes[l].gap != NULL)
+        continue;
 
-    if (gaps.empty()) {
-      pthread_mutex_unlock(&mutex);
-      pthread_yield();
-      continue;
-    }
-    GapCandidate *gap = gaps.front();
-    pop_heap(gaps.begin(), gaps.end(), compare_gap_candidate);
-    gaps.pop_back();
+      GapCandidate *gap = (n_active == 0) ? gaps->wait_pop(shard) : gaps->pop(shard);
+      if (gap == NULL)
+        break;
 
-    cur_merit  = ((double) gap->target) / TWO_POW48;
-    gaps_since_share += 1 * speed_factor;
-    pthread_mutex_unlock(&mutex);
+      cur_merit  = ((double) gap->base->target) / TWO_POW48;
+      __sync_fetch_and_add(&gaps_since_share, speed_factor);
 
-    bool found_prime = false;
+      lanes[l].gap  = gap;
+      lanes[l].next = 0;
+      gap->get_start(lanes[l].mpz_start);
+      gap->get_candidates(lanes[l].candidates);
+      test_order->sort(lanes[l].candidates, gap->n_candidates, sort_keys);
+      n_active++;
+    }
 
-    /* check all prime candidates for the current GapCandidate */
-    for (unsigned i = 0; i < gap->n_candidates && !found_prime; i++) {
-      mpz_add_ui(mpz_p, gap->mpz_gap_start, gap->candidates[i]);
-      n_test++;
+    /* test the next prime candidate of each gap */
+    sieve_t n = 0;
+    for (sieve_t l = 0; l < n_lanes; l++) {
+      FermatLane &lane = lanes[l];
 
-      if (fermat_test(mpz_p))
-        found_prime = true;
+      if (lane.gap != NULL && lane.next < lane.gap->n_candidates) {
+        mpz_add_ui(lane.mpz_p, lane.mpz_start, lane.candidates[lane.next]);
+        mpz_lane_p[n] = lane.mpz_p;
+        lane_index[n] = l;
+        n++;
+      }
     }
+    n_test += n;
 
-    if (!found_prime) {
-      log_str("Found GapCandidate: " + itoa(n_test) + " / " + 
-              itoa(gap->n_candidates) + " share [" +
-              dtoa(next_share_percent()) + " %]", LOG_D);
-      
-      /* calculate the adder */
-      mpz_previous_prime(mpz_p, gap->mpz_gap_start);
-      const uint16_t shift = mpz_sizeinbase(mpz_p, 2) - 256;
-      mpz_div_2exp(mpz_hash, mpz_p, shift);
-      mpz_mod_2exp(mpz_p, mpz_p, shift);
-
-      PoW pow(mpz_hash, shift, mpz_p, gap->target, gap->nonce);
-
-      if (pow.valid()) {
-        if (pprocessor->process(&pow)) {
-          log_str("ShareProcessor requestet reset", LOG_D);
-          ChineseSieve::reset();
-        }
-
-        pthread_mutex_lock(&mutex);
-        gaps_since_share = 0;
-        pthread_mutex_unlock(&mutex);
-      }
+    if (n > 0)
+      batch_fermat->fermat_test(mpz_lane_p, results, n);
 
-    } 
+    for (sieve_t i = 0; i < n; i++)
+      lanes[lane_index[i]].next++;
 
-    if (index % interval == 0) {
-      tests += n_test;
-      cur_tests = (cur_tests + 3 * n_test) / 4;
-     
-     
-      if (log_start < 1) 
-        log_start = mpz_log(gap->mpz_gap_start);
+    /* finish the gaps with a prime or without candidates left */
+    for (sieve_t i = 0, l = 0; l < n_lanes; l++) {
+      FermatLane &lane = lanes[l];
+      bool found_prime = false;
+
+      if (lane.gap == NULL)
+        continue;
+
+      if (i < n && lane_index[i] == l)
+        found_prime = results[i++];
+
+      if (!found_prime && lane.next < lane.gap->n_candidates)
+        continue;
+
+      GapCandidate *gap = lane.gap;
+      lane.gap = NULL;
+      n_active--;
+      index++;
+      test_order->learn(lane.candidates, lane.next, found_prime);
+
+      if (!found_prime) {
+        log_str("Found GapCandidate: " + itoa(n_test) + " / " + 
+                itoa(gap->n_candidates) + " share [" +
+                dtoa(next_share_percent()) + " %]", LOG_D);
         
-      speed_factor = get_speed_factor(cur_merit, gap->n_candidates);
-     
-      cur_n_gaps = interval;
-      cur_found_primes = (cur_found_primes + 3 * (sievesize * interval * speed_factor / log_start)) / 4;
-      found_primes += sievesize * interval * speed_factor / log_start;
-     
-      n_gaps += cur_n_gaps;
-      uint64_t cur_time = PoWUtils::gettime_usec() - time;
-      passed_time      += cur_time;
-      cur_passed_time   = (cur_passed_time + 3 * cur_time) / 4;
-      time = PoWUtils::gettime_usec();
+        if (share_queue == NULL)
+          process_share(gap);
+      } 
+
+      if (index % interval == 0) {
+        tests += n_test;
+        cur_tests = (cur_tests + 3 * n_test) / 4;
+       
+       
+        if (log_start < 1) 
+          log_start = mpz_log(lane.mpz_start);
+          
+        speed_factor = get_speed_factor(cur_merit, gap->n_candidates);
+       
+        cur_n_gaps = interval;
+        cur_found_primes = (cur_found_primes + 3 * (sievesize * interval * speed_factor / log_start)) / 4;
+        found_primes += sievesize * interval * speed_factor / log_start;
+       
+        n_gaps += cur_n_gaps;
+        uint64_t cur_time = PoWUtils::gettime_usec() - time;
+        passed_time      += cur_time;
+        cur_passed_time   = (cur_passed_time + 3 * cur_time) / 4;
+        time = PoWUtils::gettime_usec();
+      }
+
+      /* the share thread releases the gap */
+      if (!found_prime && share_queue != NULL)
+        share_queue->push(gap);
+      else
+        GapArena::release(gap);
     }
+  }
 
-    delete gap;
+  /* drop the unfinished gaps and free the lanes */
+  for (sieve_t l = 0; l < n_lanes; l++) {
+    if (lanes[l].gap != NULL)
+      GapArena::release(lanes[l].gap);
+
+    if (l > 0)
+      free(lanes[l].candidates);
+
+    mpz_clear(lanes[l].mpz_start);
+    mpz_clear(lanes[l].mpz_p);
   }
+  log_str("run_fermat stopped", LOG_D);
+}
+
+/**
+ * compares the average Fermat tests per gap of all test orders 
+ * on the best of the gaps of a random hash
+ *
+ * All candidates of the gaps are tested once, the learned order 
+ * is trained on the first half of the gaps, and all orders are 
+ * compared on the second half
+ */
+void ChineseSieve::benchmark_test_orders(uint64_t n_primes, 
+                                         ChineseSet *cset,
+                                         sieve_t n_gaps) {
+
+  ChineseSieve csieve(NULL, n_primes, cset);
+
+  /* about four times the needed gaps */
+  uint16_t shift = cset->bit_size + 2;
+  while ((1ull << (shift - cset->bit_size)) < n_gaps)
+    shift++;
+
+  /* a random hash, and the merit of a full crt gap */
+  mpz_t mpz_hash, mpz_adder, mpz_p, mpz_gap_start;
+  mpz_init_set_ui(mpz_hash, 0);
+  mpz_init_set_ui(mpz_adder, 0);
+  mpz_init(mpz_p);
+  mpz_init(mpz_gap_start);
+
+  for (sieve_t i = 0; i < 8; i++) {
+    mpz_mul_2exp(mpz_hash, mpz_hash, 32);
+    mpz_add_ui(mpz_hash, mpz_hash, rand128(csieve.rand));
+  }
+  mpz_setbit(mpz_hash, 255);
+
+  const double merit = cset->size / ((256 + shift) * log(2));
+  PoW pow(mpz_hash, shift, mpz_adder, (uint64_t) (merit * TWO_POW48), 0);
+
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  memcpy(hash, hash_prev_block, SHA256_DIGEST_LENGTH);
+
+  cout << "sieving " << (1ull << (shift - cset->bit_size)) << " gaps ..." << endl;
+  csieve.run_sieve(&pow, hash);
+
+  /* test all candidates of the best gaps once */
+  vector<vector<uint32_t> > gap_candidates;
+  vector<vector<bool> > gap_primes;
+  GapCandidate *gap;
+
+  cout << "testing the candidates of " << n_gaps << " gaps ..." << endl;
+  while (gap_candidates.size() < n_gaps && (gap = gaps->pop(0)) != NULL) {
+
+    vector<uint32_t> candidates(gap->n_candidates);
+    vector<bool> primes(gap->n_candidates);
+    gap->get_candidates(candidates.data());
+    gap->get_start(mpz_gap_start);
+
+    for (sieve_t i = 0; i < gap->n_candidates; i++) {
+      mpz_add_ui(mpz_p, mpz_gap_start, candidates[i]);
+      primes[i] = csieve.fermat_test(mpz_p);
+    }
+
+    gap_candidates.push_back(candidates);
+    gap_primes.push_back(primes);
+    GapArena::release(gap);
+  }
+  gaps->clear();
+
+  /* the number of tests until the first prime with each order */
+  const sieve_t n_train = gap_candidates.size() / 2;
+  for (sieve_t o = 0; o < TestOrder::n_orders; o++) {
+    TestOrder order(TestOrder::names[o], cset->size);
+    uint64_t n_tests = 0, n_valid = 0;
+
+    for (sieve_t g = 0; g < gap_candidates.size(); g++) {
+      vector<uint32_t> &candidates = gap_candidates[g];
+      vector<uint32_t> sorted(candidates);
+      order.sort(sorted.data(), sorted.size(), csieve.sort_keys);
+
+      sieve_t i;
+      bool found_prime = false;
+      for (i = 0; i < sorted.size() && !found_prime; i++) {
+        sieve_t j = lower_bound(candidates.begin(), 
+                                candidates.end(), 
+                                sorted[i]) - candidates.begin();
+        found_prime = gap_primes[g][j];
+      }
+
+      if (g < n_train) {
+        order.learn(sorted.data(), i, found_prime);
+        if (g + 1 == n_train)
+          order.update();
+      } else {
+        n_tests += i;
+        n_valid += !found_prime;
+      }
+    }
+
+    const sieve_t n_test_gaps = gap_candidates.size() - n_train;
+    cout << "  " << left << setw(12) << order.get_name();
+    cout << fixed << setprecision(2) << ((double) n_tests) / n_test_gaps;
+    cout << " tests per gap (" << n_valid << " of " << n_test_gaps; 
+    cout << " gaps without a prime)" << endl;
+  }
+
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_adder);
+  mpz_clear(mpz_p);
+  mpz_clear(mpz_gap_start);
 }
 
 /* finds the prevoius prime for a given mpz value (if src is not a prime) */
@@ -446,56 +1625,39 @@ void ChineseSieve::mpz_previous_prime(mpz_t mpz_dst, mpz_t mpz_src) {
   while (!fermat_test(mpz_check))
     mpz_sub_ui(mpz_check, mpz_check, 2);
 #endif
-  
-  const sieve_t sievesize = 1 << 14;
-  sieve_t sieve[sievesize];
-  mpz_t mpz_tmp;
-  mpz_init(mpz_tmp);
-
-  memset(sieve, 0, sievesize / 8);
-  for (sieve_t i = 0; i < n_primes / 10; i++) {
-    for (sieve_t p = mpz_tdiv_ui(mpz_src, primes[i]); 
-         p < sievesize; 
-         p += primes[i]) {
-      
-      set_composite(sieve, p);
-    }
-  }
 
-  for (sieve_t p = 0; p < sievesize; p++) {
-    if (is_prime(sieve, p)) {
-      mpz_sub_ui(mpz_tmp, mpz_src, p);
-      
-      if (fermat_test(mpz_tmp)) {
-        mpz_set(mpz_dst, mpz_tmp);
-        mpz_clear(mpz_tmp);
+  backward_sieve->previous_prime(mpz_dst, mpz_src);
+
 #ifdef DEBUG_PREV_PRIME
-        if (mpz_cmp(mpz_check, mpz_dst))
-          cout << "mpz_previous_prime check [FAILED]" << endl;
-        else
-          cout << "mpz_previous_prime check [VALID]" << endl;
-#endif
-        return;
-      }
-    }
-  }
+  if (mpz_cmp(mpz_check, mpz_dst))
+    cout << "mpz_previous_prime check [FAILED]" << endl;
+  else
+    cout << "mpz_previous_prime check [VALID]" << endl;
 
-  /* start again */
-  mpz_sub_ui(mpz_tmp, mpz_src, sievesize);
-  mpz_previous_prime(mpz_dst, mpz_tmp);
-  mpz_clear(mpz_tmp);
+  mpz_clear(mpz_check);
+#endif
 }
 
 
 ChineseSieve::~ChineseSieve() {
   
-  free(primorial_reminder);
   free(start_reminder);
+  free(starts32);
+  free(candidates);
+  free(sort_keys);
   free(sieve);
-
-  mpz_clear(mpz_e);
-  mpz_clear(mpz_r);
-  mpz_clear(mpz_two);
+  free(bucket_pending);
+  free(buckets);
+  free(batch);
+  free(deep_starts);
+  free(deep_sieve);
+  delete arena;
+  delete backward_sieve;
+  delete single_fermat;
+  delete batch_fermat;
+
+  for (sieve_t i = 0; i < chunks.size(); i++)
+    free(chunks[i]);
 }
 
 /* stop the current running sieve */
@@ -507,7 +1669,7 @@ void ChineseSieve::stop() {
 
 /* get gap list count */
 uint64_t ChineseSieve::gaplist_size() {
-  return gaps.size();
+  return (gaps != NULL) ? gaps->size() : 0;
 }
 
 /* return the crt status */
@@ -19,25 +19,127 @@
 #include <gmp.h>
 #include "ChineseSet.h"
 #include "GapCandidate.h"
+#include "GapArena.h"
+#include "GapQueue.h"
+#include "TestOrder.h"
+#include "FermatBackend.h"
+#include "SimdFermat.h"
+#include "BackwardSieve.h"
 #include "PoWCore/src/PoW.h"
 #include "PoWCore/src/Sieve.h"
 #include "utils.h"
 #include <vector>
+#include <queue>
 #include <openssl/sha.h>
 
+/* number of entries within a bucket chunk */
+#define BUCKET_CHUNK_SIZE 1024
+
+/* marks a bucket entry of a prime which hits after the last bucket */
+#define BUCKET_FAR 0x80000000u
+
+/* minimum number of waiting gaps before the candidate cutoff is used */
+#define CUTOFF_MIN_GAPS 1024
+
+/* size of the left margin sieved for the previous prime of a share */
+#define SHARE_MARGIN (1 << 14)
+
+/** 
+ * largest prime to sieve the margin with, larger primes remove to few
+ * candidates to pay off there reminder calculation
+ */
+#define SHARE_MARGIN_PRIMES (1 << 18)
 
 class ChineseSieve : public Sieve {
+
+  /* compares the batch sieve with the sieve of single gaps */
+  friend class ChineseSieveTest;
   
   private :
 
+    /* a sieve hit of a large prime: the prime index and the odd offset */
+    typedef struct {
+      uint32_t index;
+      uint32_t offset;
+    } BucketEntry;
+
+    /* entries of a bucket are stored in linked chunks */
+    typedef struct BucketChunk {
+      struct BucketChunk *next;
+      uint32_t size;
+      BucketEntry entries[BUCKET_CHUNK_SIZE];
+    } BucketChunk;
+
+    /**
+     * constants of a bucket sieved prime, with f = (offset - 1) / 2
+     * the hits of the following gaps are f - k * primorial / 2 mod prime.
+     * after a hit the next one is either jump_up gaps away (f += shift_up),
+     * jump_down gaps away (f -= shift_down) or jump_up + jump_down gaps
+     * away (three distance theorem)
+     */
+    typedef struct {
+      uint32_t step;
+      uint32_t jump_up;
+      uint32_t shift_up;
+      uint32_t jump_down;
+      uint32_t shift_down;
+    } BucketPrime;
+
+    /**
+     * read only tables which only depend on the ChineseSet and the 
+     * number of primes, they are calculated by the first ChineseSieve
+     * and shared by all others (the ChineseSet owns them)
+     */
+    typedef struct ChineseTables {
+      sieve_t n_primes;
+      uint32_t *primorial_reminder;
+      uint32_t *primes32;
+      sieve_t bucket_start;
+      BucketPrime *bucket_primes;
+      sieve_t cutoff_index;
+      double cutoff_ratio;
+      uint32_t *deep_primes;
+      uint32_t *deep_steps;
+      double *deep_inverse;
+
+      /* odd offsets not sieved out by the ChineseSet */
+      vector<uint32_t> set_candidates;
+
+      /* the tables of the same ChineseSet for an other number of primes */
+      struct ChineseTables *next;
+    } ChineseTables;
+
+    /* the tables used by this */
+    ChineseTables *tables;
+
+    /* calculates the shared tables for this */
+    void calc_tables();
+
+    /* frees the given tables (called by the ChineseSet) */
+    static void free_tables(void *tables);
+
     /* the ChineseSet used in these */
     ChineseSet *cset;
 
     /* the prime reminder based on the primorial */
-    sieve_t *primorial_reminder;
+    const uint32_t *primorial_reminder;
 
     /* the reminders based on the start */
-    sieve_t *start_reminder;
+    uint32_t *start_reminder;
+
+    /* 32 bit copies of the primes and the starts (for the simd kernels) */
+    const uint32_t *primes32;
+    uint32_t *starts32;
+
+    /**
+     * kernel to calculate the starts from the reminders 
+     * (after adding the primorial reminders if step is not NULL)
+     */
+    void (*update_starts)(uint32_t *starts, 
+                          uint32_t *reminder, 
+                          const uint32_t *step, 
+                          const uint32_t *primes, 
+                          sieve_t n);
 
     /* the init status of the CRT in percent */
     double crt_status;
@@ -54,17 +156,169 @@ class ChineseSieve : public Sieve {
     /* recalc sarts */
     void recalc_starts();
 
+    /* whether the primes larger than the sieve are sieved with buckets */
+    bool use_buckets;
+
+    /* index of the first bucket sieved prime */
+    sieve_t bucket_start;
+
+    /* number of buckets (gaps ahead), a power of two */
+    sieve_t n_buckets;
+
+    /* the bucket constants of each prime starting at bucket_start */
+    const BucketPrime *bucket_primes;
+
+    /* f of each parked prime (see BUCKET_FAR) */
+    uint32_t *bucket_pending;
+
+    /* the bucket ring, one chunk list for each upcoming gap */
+    BucketChunk **buckets;
+
+    /* unused chunks, and all allocated chunks */
+    BucketChunk *free_chunks;
+    vector<BucketChunk *> chunks;
+
+    /* calculates the bucket constants */
+    void calc_bucket_primes();
+
+    /* puts all bucket sieved primes into the bucket of there first hit */
+    void init_buckets();
+
+    /* adds a hit (f) of prime index i jump gaps after the given gap */
+    inline void bucket_add(sieve_t i, uint64_t gap, uint64_t jump, uint32_t f);
+
+    /**
+     * sieves the hits of all bucket sieved primes within the given gap
+     * (into the batch sieve with the given gap bit if batch is not NULL)
+     */
+    inline void bucket_sieve(uint64_t gap, sieve_t *batch, sieve_t bit);
+
+    /* reusable buffer for the prime candidates of a gap */
+    uint32_t *candidates;
+
+    /* whether 64 gaps are sieved at once */
+    bool use_batches;
+
+    /**
+     * the transposed batch sieve, one word per odd offset (offset / 2)
+     * where bit j marks the offset composite within the j'th gap
+     */
+    sieve_t *batch;
+
+    /* prime candidates of each gap within a batch */
+    vector<uint32_t> batch_candidates[64];
+
+    /* sieves the next n_gaps (<= 64) gaps at once */
+    void sieve_batch(uint64_t gap, uint64_t n_gaps, sieve_t sievesize);
+
+    /* allocates the gaps sieved by this */
+    GapArena *arena;
+
+    /* the base of the current gaps, and the gap it starts at */
+    GapBase *base;
+    uint64_t base_gap;
+
+    /* saves a sieved gap (in new_gaps until they are published) */
+    void add_gap(uint64_t gap, 
+                 const uint32_t *candidates, 
+                 uint32_t n_candidates,
+                 bool deep);
+
+    /* ln of the largest sieve prime and the largest deep prime */
+    double log_depth;
+    double log_deep_depth;
+
+    /* sieved gaps not yet published to the queue */
+    vector<GapCandidate *> new_gaps;
+
+    /**
+     * publishes the new gaps, or deletes them if they are outdated
+     * (waits while the gap queue is full)
+     */
+    void publish_gaps(uint8_t hash[SHA256_DIGEST_LENGTH]);
+
+    /**
+     * gaps which are cutoff_factor times less likely to be a valid gap
+     * than the median gap in the heap are droped (disabled if < 1)
+     */
+    double cutoff_factor;
+
+    /* gaps with more candidates are droped */
+    sieve_t cutoff;
+
+    /* index of the first prime sieved after the early cutoff check */
+    sieve_t cutoff_index;
+
+    /* expected fraction of candidates left after the cutoff check */
+    double cutoff_ratio;
+
+    /* sum of the (expected) candidates and number of sieved gaps */
+    double sum_candidates;
+    sieve_t sum_gaps;
+
+    /* recalculates the cutoff and median from the heap distribution */
+    void calc_cutoff();
+
+    /* candidate count of the median gap in the heap */
+    sieve_t heap_median;
+
+    /* number of additional primes to sieve promising gaps with */
+    sieve_t n_deep;
+
+    /* the deep primes and there (-primorial / 2) % prime */
+    const uint32_t *deep_primes;
+    const uint32_t *deep_steps;
+
+    /* (offset - 1) / 2 of the first hit of each deep prime in gap zero */
+    uint32_t *deep_starts;
+
+    /* 1.0 / deep prime */
+    const double *deep_inverse;
+
+    /* sieve of the deep primes (one bit per odd offset) */
+    sieve_t *deep_sieve;
+
+    /* generates the deep primes */
+    void calc_deep_primes();
+
+    /* calculates the deep starts for the current start */
+    void calc_deep_starts();
+
+    /**
+     * removes all candidates of the given gap which are divisible by a
+     * deep prime, and returns the new number of candidates
+     */
+    uint32_t sieve_deep(uint64_t gap, 
+                        uint32_t *candidates, 
+                        uint32_t n_candidates, 
+                        sieve_t sievesize);
+
     /* calculate the avg sieve candidates */
     void calc_avg_prime_candidates();
 
+    /* compares avg_prime_candidates with randomly sieved windows */
+    void validate_avg_prime_candidates();
+
     /* the number of average candidates in the sieve */
     double avg_prime_candidates;
 
     /* returns the theoreticaly speed increas factor for a given merit */
     double get_speed_factor(double merit, sieve_t n_candidates);
 
-    /* stores the found gaps in an shared heap */
-    static vector<GapCandidate *> gaps;
+    /* stores the found gaps in an shared sharded heap */
+    static GapQueue *gaps;
+
+    /* the queue shard of this */
+    sieve_t shard;
+
+    /* the order of the Fermat tests within a gap */
+    static TestOrder *test_order;
+
+    /* scratch keys to sort the candidates of a gap into test order */
+    uint64_t *sort_keys;
+
+    /* number of created ChineseSieves (to assign the shards) */
+    static sieve_t n_instances;
     
     /* calculated gaps since the last share */
     static sieve_t gaps_since_share;
@@ -87,8 +341,83 @@ class ChineseSieve : public Sieve {
     /* finds the prevoius prime for a given mpz value (if src is not a prime) */
     void mpz_previous_prime(mpz_t mpz_dst, mpz_t mpz_src);
 
-    /* primality testing */
-    mpz_t mpz_e, mpz_r, mpz_two;
+    /**
+     * a queue of gaps without a prime candidate, they are finalized
+     * by the share thread so the Fermat threads don't have to wait
+     */
+    class ShareQueue {
+
+      public:
+
+        ShareQueue();
+
+        ~ShareQueue();
+
+        /**
+         * removes the oldest gap (waits if this is empty), 
+         * returns NULL if this was stopped
+         */
+        GapCandidate *pull();
+
+        /* wakes up and stops all waiting pulls */
+        void stop();
+
+        /* adds a gap */
+        void push(GapCandidate *gap);
+
+        /* deletes all gaps */
+        void clear();
+
+        /* returns the number of gaps within this */
+        size_t size();
+
+      private:
+
+        queue<GapCandidate *> q;
+
+        /* indicates that the queue was stopped */
+        bool stopped;
+
+        pthread_mutex_t access_mutex;
+        pthread_cond_t notempty_cond;
+    };
+
+    /* the gaps for the share thread (NULL if it wasn't started) */
+    static ShareQueue *share_queue;
+
+    /* the share thread */
+    static void *share_thread(void *args);
+
+    /* the share thread and its ChineseSieve */
+    static pthread_t share_thread_id;
+    static ChineseSieve *share_sieve;
+
+    /* calculates the share of a gap without a prime and submits it if valid */
+    void process_share(GapCandidate *gap);
+
+    /* finds the prime before the start of the given gap */
+    void gap_previous_prime(mpz_t mpz_dst, 
+                            mpz_t mpz_gap_start, 
+                            GapCandidate *gap);
+
+    /* the fastest Fermat test of single numbers, and of batches */
+    FermatBackend *single_fermat;
+    FermatBackend *batch_fermat;
+
+    /* the sieve for the prime before a gap (tests with batch_fermat) */
+    BackwardSieve *backward_sieve;
+
+    /* a gap in a lane of the Fermat test */
+    typedef struct {
+      GapCandidate *gap;
+
+      /* the sorted candidates, and the next to test */
+      uint32_t *candidates;
+      sieve_t next;
+
+      mpz_t mpz_start;
+      mpz_t mpz_p;
+    } FermatLane;
 
     /* random */
     rand128_t *rand; 
@@ -103,9 +432,31 @@ class ChineseSieve : public Sieve {
     /* reste the sieve */
     static void reset();
 
+    /**
+     * starts the thread which finalizes the shares of all Fermat threads
+     * (otherwise each Fermat thread finalizes its shares itself)
+     */
+    static void start_share_thread(PoWProcessor *processor,
+                                   uint64_t n_primes, 
+                                   ChineseSet *cset);
+
+    /**
+     * stops the share thread and waits until it is finished
+     * (the Fermat threads have to be stopped before)
+     */
+    static void stop_share_thread();
+
     /* get gap list count */
     static uint64_t gaplist_size();
 
+    /**
+     * compares the average Fermat tests per gap of all test orders 
+     * on the best of the gaps of a random hash
+     */
+    static void benchmark_test_orders(uint64_t n_primes, 
+                                      ChineseSet *cset,
+                                      sieve_t n_gaps);
+
     /* stop the current running sieve */
     void stop();
 
@@ -130,8 +481,9 @@ class ChineseSieve : public Sieve {
 
     /**
      * process the GapCandidates (allways most promising first)
+     * while running is true
      */
-    void run_fermat();
+    void run_fermat(bool *running);
 
     /** returns the calulation percent of the next share */
     static double next_share_percent();
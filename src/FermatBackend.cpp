@@ -0,0 +1,235 @@
+/**
+ * Implementation of the interface of the Fermat tests, and the selection
+ * of the fastest one at startup
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include "PoWCore/src/PoWUtils.h"
+#include "FermatBackend.h"
+#include "MpnFermat.h"
+#include "SimdFermat.h"
+#include "Opts.h"
+
+using namespace std;
+
+/* the names of all backends */
+const char *FermatBackend::names[] = { "gmp", "mpn", "simd" };
+const sieve_t FermatBackend::n_names = sizeof(names) / sizeof(names[0]);
+
+/* the backends the calibration selects from (mpn only if forced) */
+const char *FermatBackend::calibrated_names[] = { "gmp", "simd" };
+const sieve_t FermatBackend::n_calibrated_names = 
+  sizeof(calibrated_names) / sizeof(calibrated_names[0]);
+
+/* the selected backends per bit width */
+map<sieve_t, FermatBackend::Selection> FermatBackend::selections;
+pthread_mutex_t FermatBackend::mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* creates the backend with the given name (NULL if unknown or unsupported) */
+FermatBackend *FermatBackend::create(const char *name) {
+
+  if (!strcmp(name, "gmp"))
+    return new GmpFermat();
+
+  if (!strcmp(name, "mpn"))
+    return new MpnFermat();
+
+  if (!strcmp(name, "simd") && SimdFermat::supported())
+    return new SimdFermat();
+
+  return NULL;
+}
+
+/**
+ * creates the fastest backend for numbers with the given bits
+ * (with one lane, or for batches), each bit width is calibrated once
+ */
+FermatBackend *FermatBackend::create_fastest(sieve_t bits, bool batch) {
+
+  pthread_mutex_lock(&mutex);
+  map<sieve_t, Selection>::iterator it = selections.find(bits);
+  if (it == selections.end())
+    it = selections.insert(make_pair(bits, calibrate(bits))).first;
+
+  const char *name = batch ? it->second.batch_name : it->second.single_name;
+  pthread_mutex_unlock(&mutex);
+
+  return create(name);
+}
+
+/* returns the microseconds per test of the given backend */
+double FermatBackend::benchmark(FermatBackend *backend, mpz_t *mpz_numbers, sieve_t n) {
+
+  const sieve_t lanes = backend->get_lanes();
+  mpz_ptr *mpz_p = (mpz_ptr *) malloc(sizeof(mpz_ptr) * lanes);
+  bool *results  = (bool *) malloc(sizeof(bool) * lanes);
+
+  sieve_t n_tests = 0;
+  uint64_t time = PoWUtils::gettime_usec();
+
+  while (n_tests < n && PoWUtils::gettime_usec() - time < FERMAT_BACKEND_BENCH_USEC) {
+
+    sieve_t i;
+    for (i = 0; i < lanes && n_tests + i < n; i++)
+      mpz_p[i] = mpz_numbers[n_tests + i];
+
+    backend->fermat_test(mpz_p, results, i);
+    n_tests += i;
+  }
+  time = PoWUtils::gettime_usec() - time;
+
+  free(mpz_p);
+  free(results);
+
+  return ((double) time) / n_tests;
+}
+
+/**
+ * benchmarks the supported calibrated_names with random odd numbers 
+ * of the given bits and selects the fastest 
+ *
+ * a backend forced by --fermat-backend is used for batches, and for 
+ * single tests if it has one lane (else only the backends with one
+ * lane are benchmarked)
+ */
+FermatBackend::Selection FermatBackend::calibrate(sieve_t bits) {
+
+  Selection selection = { NULL, NULL };
+  const char *forced  = NULL;
+
+  Opts *opts = Opts::get_instance();
+  if (opts->has_fermat_backend()) {
+
+    for (sieve_t i = 0; i < n_names; i++)
+      if (opts->get_fermat_backend() == names[i])
+        forced = names[i];
+
+    FermatBackend *backend = (forced != NULL) ? create(forced) : NULL;
+    if (backend == NULL) {
+      cout << "Fermat backend " << opts->get_fermat_backend();
+      cout << " is unknown or not supported by this cpu" << endl;
+      exit(EXIT_FAILURE);
+    }
+    log_str("using the forced Fermat backend " + opts->get_fermat_backend(), LOG_D);
+
+    selection.batch_name = forced;
+    if (backend->get_lanes() == 1)
+      selection.single_name = forced;
+
+    delete backend;
+    if (selection.single_name != NULL)
+      return selection;
+  }
+
+  mpz_t *mpz_numbers = (mpz_t *) malloc(sizeof(mpz_t) * FERMAT_BACKEND_BENCH_TESTS);
+  gmp_randstate_t rand;
+  gmp_randinit_default(rand);
+
+  for (sieve_t i = 0; i < FERMAT_BACKEND_BENCH_TESTS; i++) {
+    mpz_init(mpz_numbers[i]);
+    mpz_urandomb(mpz_numbers[i], rand, bits);
+    mpz_setbit(mpz_numbers[i], bits - 1);
+    mpz_setbit(mpz_numbers[i], 0);
+  }
+
+  double single_time = 0.0, batch_time = 0.0;
+  stringstream ss;
+  ss << fixed << setprecision(2);
+
+  for (sieve_t i = 0; i < n_calibrated_names; i++) {
+    const char *name = calibrated_names[i];
+    FermatBackend *backend = create(name);
+    if (backend == NULL)
+      continue;
+
+    if (forced != NULL && backend->get_lanes() > 1) {
+      delete backend;
+      continue;
+    }
+
+    const double time = benchmark(backend, mpz_numbers, FERMAT_BACKEND_BENCH_TESTS);
+    ss << " " << name << " " << time << " us";
+
+    if (backend->get_lanes() == 1 && 
+        (selection.single_name == NULL || time < single_time)) {
+      selection.single_name = name;
+      single_time           = time;
+    }
+
+    if (forced == NULL && (selection.batch_name == NULL || time < batch_time)) {
+      selection.batch_name = name;
+      batch_time           = time;
+    }
+
+    delete backend;
+  }
+
+  for (sieve_t i = 0; i < FERMAT_BACKEND_BENCH_TESTS; i++)
+    mpz_clear(mpz_numbers[i]);
+
+  free(mpz_numbers);
+  gmp_randclear(rand);
+
+  pthread_mutex_lock(&io_mutex);
+  cout << get_time() << "Fermat tests of " << bits << " bits:" << ss.str() << endl;
+  cout << get_time() << "using " << selection.single_name << " for single tests and ";
+  cout << selection.batch_name << " for batches" << endl;
+  pthread_mutex_unlock(&io_mutex);
+
+  return selection;
+}
+
+GmpFermat::GmpFermat() {
+
+  mpz_init(mpz_e);
+  mpz_init(mpz_r);
+  mpz_init_set_ui(mpz_two, 2);
+}
+
+GmpFermat::~GmpFermat() {
+
+  mpz_clear(mpz_e);
+  mpz_clear(mpz_r);
+  mpz_clear(mpz_two);
+}
+
+const char *GmpFermat::get_name() {
+  return "gmp";
+}
+
+sieve_t GmpFermat::get_lanes() {
+  return 1;
+}
+
+/* Fermat base 2 test of n numbers */
+void GmpFermat::fermat_test(mpz_ptr *mpz_p, bool *results, sieve_t n) {
+
+  for (sieve_t i = 0; i < n; i++) {
+
+    /* tmp = p - 1 */
+    mpz_sub_ui(mpz_e, mpz_p[i], 1);
+
+    /* res = 2^tmp mod p */
+    mpz_powm(mpz_r, mpz_two, mpz_e, mpz_p[i]);
+
+    results[i] = (mpz_cmp_ui(mpz_r, 1) == 0);
+  }
+}
@@ -0,0 +1,124 @@
+/**
+ * Header file of the interface of the Fermat tests, and the selection
+ * of the fastest one at startup
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __FERMAT_BACKEND_H__
+#define __FERMAT_BACKEND_H__
+
+#include <pthread.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <map>
+#include "utils.h"
+
+using namespace std;
+
+/* numbers tested per backend by the calibration (at most) */
+#define FERMAT_BACKEND_BENCH_TESTS 1024
+
+/* time spend per backend by the calibration (at most) */
+#define FERMAT_BACKEND_BENCH_USEC 50000
+
+/**
+ * A Fermat base 2 test of a batch of numbers.
+ *
+ * Each backend tests up to get_lanes() numbers at once, the callers
+ * which test one number after an other (e.g. searching the previous
+ * prime) use the fastest backend with one lane, the callers which
+ * can fill all lanes (the Fermat threads of the ChineseSieve) use the
+ * fastest backend per test.
+ *
+ * Both are calibrated once per bit width of the tested numbers, or 
+ * forced with --fermat-backend (a forced backend with more than one
+ * lane is only used for batches). The MpnFermat is only used if forced,
+ * it was slower than gmp's mpz_powm on all measured hosts.
+ */
+class FermatBackend {
+
+  public:
+
+    virtual ~FermatBackend() { }
+
+    /* the name of this backend */
+    virtual const char *get_name() = 0;
+
+    /* the number of numbers tested at once */
+    virtual sieve_t get_lanes() = 0;
+
+    /* Fermat base 2 test of n numbers (up to get_lanes()) */
+    virtual void fermat_test(mpz_ptr *mpz_p, bool *results, sieve_t n) = 0;
+
+    /* creates the backend with the given name (NULL if unknown or unsupported) */
+    static FermatBackend *create(const char *name);
+
+    /**
+     * creates the fastest backend for numbers with the given bits
+     * (with one lane, or for batches)
+     */
+    static FermatBackend *create_fastest(sieve_t bits, bool batch);
+
+    /* the names of all backends */
+    static const char *names[];
+    static const sieve_t n_names;
+
+  private:
+
+    /* the selected backends for one bit width */
+    typedef struct {
+      const char *single_name;
+      const char *batch_name;
+    } Selection;
+
+    /* the selected backends per bit width */
+    static map<sieve_t, Selection> selections;
+
+    /* the backends the calibration selects from */
+    static const char *calibrated_names[];
+    static const sieve_t n_calibrated_names;
+    static pthread_mutex_t mutex;
+
+    /* benchmarks all supported backends and selects the fastest */
+    static Selection calibrate(sieve_t bits);
+
+    /* returns the microseconds per test of the given backend */
+    static double benchmark(FermatBackend *backend, mpz_t *mpz_numbers, sieve_t n);
+};
+
+/**
+ * Fermat test with gmp's mpz_powm
+ */
+class GmpFermat : public FermatBackend {
+
+  public:
+
+    GmpFermat();
+
+    ~GmpFermat();
+
+    const char *get_name();
+
+    sieve_t get_lanes();
+
+    void fermat_test(mpz_ptr *mpz_p, bool *results, sieve_t n);
+
+  private:
+
+    mpz_t mpz_e, mpz_r, mpz_two;
+};
+
+#endif /* __FERMAT_BACKEND_H__ */
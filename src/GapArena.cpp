@@ -0,0 +1,122 @@
+/**
+ * Implementation of a slab allocator of GapCandidates
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <iostream>
+#include "GapArena.h"
+#include "utils.h"
+
+/* the bytes of all allocated slabs */
+volatile uint64_t GapArena::n_bytes = 0;
+
+GapArena::GapArena() {
+  this->slab = NULL;
+}
+
+GapArena::~GapArena() {
+  if (slab != NULL)
+    release(slab);
+}
+
+/* creates a new slab with at least the given free bytes */
+void GapArena::new_slab(uint64_t bytes) {
+
+  if (slab != NULL)
+    release(slab);
+
+  if (bytes < GAP_SLAB_SIZE)
+    bytes = GAP_SLAB_SIZE;
+
+  slab = (GapSlab *) malloc(sizeof(GapSlab) + bytes);
+  if (slab == NULL) {
+    cout << "failed to allocate " << bytes << " bytes for the gaps" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  slab->refs = 1;
+  slab->size = bytes;
+  slab->used = 0;
+  __sync_fetch_and_add(&n_bytes, sizeof(GapSlab) + bytes);
+}
+
+/* creates a new gap in the current slab */
+GapCandidate *GapArena::alloc(GapBase *base, 
+                              uint32_t index,
+                              const uint32_t *candidates,
+                              uint32_t n_candidates) {
+
+  /* space for the worst case encoding, the unused rest is given back */
+  const uint64_t bytes = GapCandidate::bytes(3 * n_candidates);
+  if (slab == NULL || slab->size - slab->used < bytes)
+    new_slab(bytes);
+
+  void *ptr = ((uint8_t *) slab->data) + slab->used;
+  GapCandidate *gap = new (ptr) GapCandidate(base, 
+                                             slab, 
+                                             index, 
+                                             candidates, 
+                                             n_candidates);
+
+  slab->used += gap->bytes();
+  __sync_fetch_and_add(&slab->refs, 1);
+
+  return gap;
+}
+
+/**
+ * moves the given gap into the current slab, so it no longer keeps
+ * its old slab allocated (returns the moved gap)
+ */
+GapCandidate *GapArena::move(GapCandidate *gap) {
+
+  const uint64_t bytes = gap->bytes();
+  if (slab == NULL || slab->size - slab->used < bytes)
+    new_slab(bytes);
+
+  GapCandidate *moved = (GapCandidate *) (((uint8_t *) slab->data) + slab->used);
+  memcpy(moved, gap, bytes);
+  moved->slab = slab;
+
+  slab->used += bytes;
+  __sync_fetch_and_add(&slab->refs, 1);
+
+  /* the reference of the base moves with the gap */
+  release(gap->slab);
+  return moved;
+}
+
+/* releases the given gap (and its slab if it was the last gap in it) */
+void GapArena::release(GapCandidate *gap) {
+  gap->base->release();
+  release(gap->slab);
+}
+
+/* removes a reference from the given slab, frees it if it was the last one */
+void GapArena::release(GapSlab *slab) {
+  if (__sync_sub_and_fetch(&slab->refs, 1) == 0) {
+    __sync_fetch_and_sub(&n_bytes, sizeof(GapSlab) + slab->size);
+    free(slab);
+  }
+}
+
+/* returns the bytes of all allocated slabs */
+uint64_t GapArena::get_bytes() {
+  return n_bytes;
+}
@@ -0,0 +1,91 @@
+/**
+ * Header file for a slab allocator of GapCandidates
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __GAP_ARENA_H__
+#define __GAP_ARENA_H__
+
+#include <inttypes.h>
+#include "GapCandidate.h"
+
+/* default size of a GapSlab in bytes */
+#define GAP_SLAB_SIZE (1 << 20)
+
+/**
+ * a memory block holding GapCandidates, it is freed at once after 
+ * all of its gaps where released
+ */
+struct GapSlab {
+
+  /* number of references (the arena while it allocates in it, and each gap) */
+  volatile uint32_t refs;
+
+  /* the size and the used bytes of data */
+  uint64_t size;
+  uint64_t used;
+
+  /* the gaps (8 byte aligned) */
+  uint64_t data[1];
+};
+
+/**
+ * allocates the GapCandidates of one sieve thread from large slabs,
+ * so sieving doesn't need a malloc per gap, and freeing is batched
+ * (a slab is released by the thread which releases its last gap)
+ */
+class GapArena {
+
+  public:
+
+    GapArena();
+
+    ~GapArena();
+
+    /* creates a new gap in the current slab */
+    GapCandidate *alloc(GapBase *base, 
+                        uint32_t index,
+                        const uint32_t *candidates,
+                        uint32_t n_candidates);
+
+    /**
+     * moves the given gap into the current slab, so it no longer keeps
+     * its old slab allocated (returns the moved gap)
+     */
+    GapCandidate *move(GapCandidate *gap);
+
+    /* releases the given gap (and its slab if it was the last gap in it) */
+    static void release(GapCandidate *gap);
+
+    /* returns the bytes of all allocated slabs */
+    static uint64_t get_bytes();
+
+  private:
+
+    /* the slab new gaps are allocated in */
+    GapSlab *slab;
+
+    /* the bytes of all allocated slabs */
+    static volatile uint64_t n_bytes;
+
+    /* creates a new slab with at least the given free bytes */
+    void new_slab(uint64_t bytes);
+
+    /* removes a reference from the given slab, frees it if it was the last one */
+    static void release(GapSlab *slab);
+};
+
+#endif /* __GAP_ARENA_H__ */
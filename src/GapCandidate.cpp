@@ -16,22 +16,160 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdlib.h>
+#include <math.h>
 #include "GapCandidate.h"
 
-/* creat a new GapCandidate */
-GapCandidate::GapCandidate(uint32_t nonce,
-                           uint64_t target,
-                           mpz_t mpz_gap_start, 
-                           vector<uint32_t> candidates) {
+/* e^gamma (Mertens' third theorem) */
+#define EXP_GAMMA 1.7810724179901979
 
-  this->nonce        = nonce;
-  this->target       = target;
-  this->n_candidates = candidates.size();
-  this->candidates   = vector<uint32_t>(candidates);
-  mpz_init_set(this->mpz_gap_start, mpz_gap_start);
+/* creates a new GapBase with one reference */
+GapBase::GapBase(uint32_t nonce, 
+                 uint64_t target, 
+                 mpz_t mpz_start, 
+                 mpz_t mpz_primorial) {
+
+  this->nonce  = nonce;
+  this->target = target;
+  this->refs   = 1;
+  this->reminder           = NULL;
+  this->primorial_reminder = NULL;
+  this->n_reminder         = 0;
+  this->log_start          = 0.0;
+  this->sievesize          = 0;
+  mpz_init_set(this->mpz_start, mpz_start);
+  mpz_init_set(this->mpz_primorial, mpz_primorial);
+}
+
+GapBase::~GapBase() {
+  free(reminder);
+  mpz_clear(mpz_start);
+  mpz_clear(mpz_primorial);
+}
+
+/* adds a reference */
+void GapBase::retain() {
+  __sync_fetch_and_add(&refs, 1);
 }
 
-GapCandidate::~GapCandidate() {
-  candidates.clear();
-  mpz_clear(mpz_gap_start);
+/* removes a reference, deletes this if it was the last one */
+void GapBase::release() {
+  if (__sync_sub_and_fetch(&refs, 1) == 0)
+    delete this;
+}
+
+/**
+ * creates a new GapCandidate and encodes the given candidates behind it
+ * (there have to be 3 * n_candidates words free behind this)
+ */
+GapCandidate::GapCandidate(GapBase *base,
+                           GapSlab *slab,
+                           uint32_t index,
+                           const uint32_t *candidates,
+                           uint32_t n_candidates) {
+
+  this->base         = base;
+  this->slab         = slab;
+  this->index        = index;
+  this->n_candidates = n_candidates;
+  this->log_depth    = 0.0;
+  this->score        = 0.0;
+
+  uint16_t *words = this->words();
+  uint32_t n = 0, last = 1;
+  for (uint32_t i = 0; i < n_candidates; i++) {
+    const uint32_t delta = (candidates[i] - last) >> 1;
+
+    if (delta < GAP_DELTA_ESCAPE) {
+      words[n++] = delta;
+    } else {
+      words[n++] = GAP_DELTA_ESCAPE;
+      words[n++] = delta & 0xFFFF;
+      words[n++] = delta >> 16;
+    }
+    last = candidates[i];
+  }
+  this->n_words = n;
+
+  base->retain();
+}
+
+/* calculates the gap start */
+void GapCandidate::get_start(mpz_t mpz_dst) {
+  mpz_set(mpz_dst, base->mpz_start);
+  mpz_addmul_ui(mpz_dst, base->mpz_primorial, index);
+}
+
+/* decodes the candidates into dst, returns the number of candidates */
+uint32_t GapCandidate::get_candidates(uint32_t *dst) {
+
+  const uint16_t *words = this->words();
+  uint32_t last = 1;
+  for (uint32_t i = 0, n = 0; i < n_candidates; i++) {
+    uint32_t delta = words[n++];
+
+    if (delta == GAP_DELTA_ESCAPE) {
+      delta  = words[n++];
+      delta |= ((uint32_t) words[n++]) << 16;
+    }
+
+    last  += delta << 1;
+    dst[i] = last;
+  }
+
+  return n_candidates;
+}
+
+/* returns the number of candidates below end */
+uint32_t GapCandidate::count_candidates(uint32_t end) {
+
+  const uint16_t *words = this->words();
+  uint32_t last = 1;
+  for (uint32_t i = 0, n = 0; i < n_candidates; i++) {
+    uint32_t delta = words[n++];
+
+    if (delta == GAP_DELTA_ESCAPE) {
+      delta  = words[n++];
+      delta |= ((uint32_t) words[n++]) << 16;
+    }
+
+    last += delta << 1;
+    if (last >= end)
+      return i;
+  }
+
+  return n_candidates;
+}
+
+/**
+ * calculates the score of this for the given target: the log of the 
+ * probability that this is a valid gap, per expected Fermat test
+ *
+ * A candidate sieved up to the prime P is a prime with the probability
+ * q = e^gamma * ln(P) / ln(start) (Mertens), all candidates within the
+ * target gap length have to be composite, and the part of the gap behind
+ * the sieved window is unsieved. The Fermat tests stop at the first prime,
+ * so (1 - (1 - q)^n) / q tests are expected.
+ */
+void GapCandidate::calc_score(uint64_t target) {
+
+  const double length = ldexp((double) target, -48) * base->log_start;
+  double log_valid = 0.0;
+  uint32_t n = n_candidates;
+
+  if (length > base->sievesize)
+    log_valid = -(length - base->sievesize) / base->log_start;
+  else if (length > 0.0)
+    n = count_candidates(ceil(length));
+
+  double q = EXP_GAMMA * log_depth / base->log_start;
+  if (!(q > 1e-9))
+    q = 1e-9;
+  else if (q > 0.99)
+    q = 0.99;
+
+  const double log_composite = log1p(-q);
+  const double tests = (n > 0) ? -expm1(n * log_composite) / q : 1.0;
+
+  score = log_valid + n * log_composite - log(tests);
 }
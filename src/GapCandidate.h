@@ -21,36 +21,124 @@
 
 #include <gmp.h>
 #include <inttypes.h>
-#include <vector>
 
-using namespace std;
+/* escape of a candidate delta which does not fit into 16 bit */
+#define GAP_DELTA_ESCAPE 0xFFFF
 
-class GapCandidate {
+struct GapSlab;
 
-  public: 
+/**
+ * the start, nonce and target of a run_sieve call, shared by all of 
+ * its gaps (reference counted)
+ */
+class GapBase {
+
+  public:
 
-    /* the nonce of this */
+    /* the nonce */
     uint32_t nonce;
 
     /* the target */
     uint64_t target;
- 
-    /* the gap start */
-    mpz_t mpz_gap_start;
+
+    /* the start of the first gap */
+    mpz_t mpz_start;
+
+    /* the distance between two gaps */
+    mpz_t mpz_primorial;
+
+    /**
+     * the reminders of the start and the primorial modulo the first
+     * n_reminder sieve primes (NULL if unknown)
+     */
+    uint32_t *reminder;
+    const uint32_t *primorial_reminder;
+    uint32_t n_reminder;
+
+    /* ln(start) and the sieved size of the gaps */
+    double log_start;
+    uint32_t sievesize;
+
+    /* number of references (the creator and each gap) */
+    volatile uint32_t refs;
+
+    /* creates a new GapBase with one reference */
+    GapBase(uint32_t nonce, 
+            uint64_t target, 
+            mpz_t mpz_start, 
+            mpz_t mpz_primorial);
+
+    ~GapBase();
+
+    /* adds a reference */
+    void retain();
+
+    /* removes a reference, deletes this if it was the last one */
+    void release();
+};
+
+/**
+ * a compact prime gap candidate, allocated within a GapSlab followed by
+ * its candidate offsets
+ *
+ * The offsets are odd and ascending, so they are stored as 16 bit
+ * half deltas (GAP_DELTA_ESCAPE followed by two words if it doesn't fit),
+ * the gap start is base start + index * primorial
+ */
+class GapCandidate {
+
+  public: 
+
+    /* the base of this */
+    GapBase *base;
+
+    /* the slab this is allocated in */
+    GapSlab *slab;
+
+    /* the index of this gap after the base start */
+    uint32_t index;
  
     /* the number of prime candidates */
     uint32_t n_candidates;
- 
-    /* the candidate offsets */
-    vector<uint32_t> candidates;
-
-    /* creat a new GapCandidate */
-    GapCandidate(uint32_t nonce,
-                 uint64_t target,
-                 mpz_t mpz_gap_start, 
-                 vector<uint32_t> candidates);
- 
-    ~GapCandidate();
+
+    /* the number of 16 bit words of the encoded candidates */
+    uint32_t n_words;
+
+    /* ln of the largest prime this was sieved with */
+    float log_depth;
+
+    /* the log of the valid gap probability per expected Fermat test */
+    float score;
+
+    /* the encoded candidates (stored behind this) */
+    inline uint16_t *words() { return (uint16_t *) (this + 1); }
+
+    /* returns the number of bytes needed for a gap with n words */
+    static inline uint64_t bytes(uint32_t n_words) { 
+      return (sizeof(GapCandidate) + n_words * sizeof(uint16_t) + 7) & ~7ULL;
+    }
+
+    /* returns the number of bytes used by this */
+    inline uint64_t bytes() { return bytes(n_words); }
+
+    /* creates a new GapCandidate and encodes the given candidates behind it */
+    GapCandidate(GapBase *base,
+                 GapSlab *slab,
+                 uint32_t index,
+                 const uint32_t *candidates,
+                 uint32_t n_candidates);
+
+    /* calculates the gap start */
+    void get_start(mpz_t mpz_dst);
+
+    /* decodes the candidates into dst, returns the number of candidates */
+    uint32_t get_candidates(uint32_t *dst);
+
+    /* returns the number of candidates below end */
+    uint32_t count_candidates(uint32_t end);
+
+    /* calculates the score of this for the given target */
+    void calc_score(uint64_t target);
 };
 
 #endif
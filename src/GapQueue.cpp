@@ -0,0 +1,412 @@
+/**
+ * Implementation of a sharded priority queue of GapCandidates
+ * used in the ChineseSieve
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __STDC_LIMIT_MACROS
+#define __STDC_LIMIT_MACROS
+#endif
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <algorithm>
+#include "GapQueue.h"
+#include "GapArena.h"
+
+using namespace std;
+
+/* compare function to sort by score (the best gap is the heap top) */
+static bool compare_gap_candidate(GapCandidate *a, GapCandidate *b) {
+  return a->score < b->score;
+}
+
+/**
+ * creates a new GapQueue for gaps with up to max_candidates,
+ * with the given memory budget in bytes (unbounded if zero)
+ */
+GapQueue::GapQueue(sieve_t n_shards, 
+                   sieve_t max_candidates, 
+                   uint64_t max_bytes,
+                   bool evict) {
+
+  log_str("creating GapQueue with " + itoa(n_shards) + " shards and " + 
+          itoa(max_bytes) + " bytes", LOG_D);
+  this->n_shards       = (n_shards > 0) ? n_shards : 1;
+  this->next_shard     = 0;
+  this->n_gaps         = 0;
+  this->target         = 0;
+  this->max_bytes      = max_bytes;
+  this->evict          = evict;
+  this->n_waiting      = 0;
+  this->n_blocked      = 0;
+  this->max_candidates = max_candidates;
+  this->histogram      = (sieve_t *) calloc(max_candidates + 1, sizeof(sieve_t));
+  this->shards         = (Shard **) malloc(sizeof(Shard *) * this->n_shards);
+
+  for (sieve_t i = 0; i < this->n_shards; i++) {
+    shards[i] = new Shard();
+    shards[i]->best   = GAP_QUEUE_EMPTY;
+    shards[i]->spins  = GAP_QUEUE_MIN_SPINS;
+    shards[i]->victim = i;
+    shards[i]->arena  = new GapArena();
+    pthread_mutex_init(&shards[i]->mutex, NULL);
+  }
+
+  pthread_mutex_init(&wait_mutex, NULL);
+  pthread_cond_init(&not_empty, NULL);
+  pthread_cond_init(&not_full, NULL);
+}
+
+GapQueue::~GapQueue() {
+
+  clear();
+  for (sieve_t i = 0; i < n_shards; i++) {
+    delete shards[i]->arena;
+    pthread_mutex_destroy(&shards[i]->mutex);
+    delete shards[i];
+  }
+  free(shards);
+  free(histogram);
+
+  pthread_mutex_destroy(&wait_mutex);
+  pthread_cond_destroy(&not_empty);
+  pthread_cond_destroy(&not_full);
+}
+
+/* updates the counters for an added (sign = 1) or removed gap */
+void GapQueue::count(GapCandidate *gap, int sign) {
+
+  const sieve_t n = min((sieve_t) gap->n_candidates, max_candidates);
+  __sync_fetch_and_add(&histogram[n], sign);
+  __sync_fetch_and_add(&n_gaps, sign);
+}
+
+/* scores and publishes the given gaps into the next shard (clears gaps) */
+void GapQueue::push(vector<GapCandidate *> &gaps) {
+
+  if (gaps.empty())
+    return;
+
+  uint64_t scored = target;
+  for (sieve_t i = 0; i < gaps.size(); i++) {
+    gaps[i]->calc_score(scored);
+    count(gaps[i], 1);
+  }
+
+  Shard *shard = shards[__sync_fetch_and_add(&next_shard, 1) % n_shards];
+
+  pthread_mutex_lock(&shard->mutex);
+
+  /* the target changed in the meantime */
+  if (scored != target) {
+    scored = target;
+    for (sieve_t i = 0; i < gaps.size(); i++)
+      gaps[i]->calc_score(scored);
+  }
+
+  for (sieve_t i = 0; i < gaps.size(); i++) {
+    shard->heap.push_back(gaps[i]);
+    push_heap(shard->heap.begin(), shard->heap.end(), compare_gap_candidate);
+  }
+
+  if (evict && max_bytes > 0 && GapArena::get_bytes() > max_bytes)
+    evict_locked(shard);
+
+  update_best(shard);
+  pthread_mutex_unlock(&shard->mutex);
+
+  gaps.clear();
+
+  /* wake up the waiting consumers */
+  if (n_waiting > 0) {
+    pthread_mutex_lock(&wait_mutex);
+    pthread_cond_broadcast(&not_empty);
+    pthread_mutex_unlock(&wait_mutex);
+  }
+}
+
+/**
+ * sets the target to score the gaps with, and rescores all gaps 
+ * if it changed
+ */
+void GapQueue::set_target(uint64_t target) {
+
+  if (this->target == target)
+    return;
+
+  log_str("GapQueue rescoring " + itoa(n_gaps) + " gaps for target " + 
+          itoa(target), LOG_D);
+  this->target = target;
+
+  for (sieve_t i = 0; i < n_shards; i++) {
+    Shard *shard = shards[i];
+    pthread_mutex_lock(&shard->mutex);
+
+    for (sieve_t j = 0; j < shard->heap.size(); j++)
+      shard->heap[j]->calc_score(target);
+
+    make_heap(shard->heap.begin(), shard->heap.end(), compare_gap_candidate);
+    update_best(shard);
+    pthread_mutex_unlock(&shard->mutex);
+  }
+}
+
+/* updates the cached best score of the given shard (needs the shard lock) */
+void GapQueue::update_best(Shard *shard) {
+  float best = shard->heap.empty() ? GAP_QUEUE_EMPTY : shard->heap.front()->score;
+  __atomic_store(&shard->best, &best, __ATOMIC_RELEASE);
+}
+
+/* returns the cached best score of the given shard */
+float GapQueue::load_best(Shard *shard) {
+  float best;
+  __atomic_load(&shard->best, &best, __ATOMIC_ACQUIRE);
+  return best;
+}
+
+/* returns the shard with the best gap, except the given one */
+GapQueue::Shard *GapQueue::best_other(sieve_t shard) {
+
+  Shard *best      = NULL;
+  float best_score = GAP_QUEUE_EMPTY;
+  for (sieve_t i = 0; i < n_shards; i++) {
+    const float score = load_best(shards[i]);
+
+    if (i != shard && score > best_score) {
+      best       = shards[i];
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+/**
+ * evicts the worst gaps of the given shard, and moves the others 
+ * into the slabs of the shard (needs the shard lock)
+ *
+ * the worst eighth is removed at once, so the linear selection and
+ * moving the survivors cost a constant amount per evicted gap
+ */
+void GapQueue::evict_locked(Shard *shard) {
+
+  vector<GapCandidate *> &heap = shard->heap;
+  const sieve_t n = heap.size() / 8 + 1;
+  if (n > heap.size())
+    return;
+
+  nth_element(heap.begin(), heap.begin() + (n - 1), heap.end(), compare_gap_candidate);
+  for (sieve_t i = 0; i < n; i++) {
+    count(heap[i], -1);
+    GapArena::release(heap[i]);
+  }
+
+  heap.erase(heap.begin(), heap.begin() + n);
+  for (sieve_t i = 0; i < heap.size(); i++)
+    heap[i] = shard->arena->move(heap[i]);
+
+  make_heap(heap.begin(), heap.end(), compare_gap_candidate);
+  log_str("GapQueue evicted " + itoa(n) + " gaps", LOG_D);
+}
+
+/* pops the best gap of the given shard (needs the shard lock) */
+GapCandidate *GapQueue::pop_locked(Shard *shard) {
+
+  if (shard->heap.empty())
+    return NULL;
+
+  GapCandidate *gap = shard->heap.front();
+  pop_heap(shard->heap.begin(), shard->heap.end(), compare_gap_candidate);
+  shard->heap.pop_back();
+  update_best(shard);
+
+  count(gap, -1);
+  return gap;
+}
+
+/**
+ * returns the best gap for the given shard (NULL if all are empty)
+ *
+ * the own shard is used, unless it is empty or the checked other
+ * shard has a clearly better gap (according to the cached best scores)
+ */
+GapCandidate *GapQueue::pop(sieve_t shard) {
+
+  shard %= n_shards;
+  Shard *own = shards[shard];
+
+  for (sieve_t retry = 0; retry < 2; retry++) {
+    Shard *from = own;
+    const float own_best = load_best(own);
+
+    if (n_shards > 1) {
+      if (own_best == GAP_QUEUE_EMPTY) {
+        from = best_other(shard);
+        if (from == NULL)
+          return NULL;
+      } else {
+
+        /* checks only one other shard, to not touch all shards per pop */
+        own->victim = (own->victim + 1) % n_shards;
+        if (own->victim == shard)
+          own->victim = (own->victim + 1) % n_shards;
+
+        Shard *other = shards[own->victim];
+        if (load_best(other) > own_best + GAP_QUEUE_STEAL_MARGIN)
+          from = other;
+      }
+    } else if (own_best == GAP_QUEUE_EMPTY)
+      return NULL;
+
+    pthread_mutex_lock(&from->mutex);
+    GapCandidate *gap = pop_locked(from);
+    pthread_mutex_unlock(&from->mutex);
+
+    /* the shard was emptied by an other thread in the meantime */
+    if (gap == NULL)
+      continue;
+
+    /* wake up the blocked producers */
+    if (n_blocked > 0 && !full()) {
+      pthread_mutex_lock(&wait_mutex);
+      pthread_cond_broadcast(&not_full);
+      pthread_mutex_unlock(&wait_mutex);
+    }
+
+    return gap;
+  }
+
+  return NULL;
+}
+
+/* waits for the given condition at most timeout microseconds */
+void GapQueue::timed_wait(pthread_cond_t *cond, uint64_t timeout) {
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+
+  const uint64_t usec = now.tv_usec + timeout;
+  struct timespec until;
+  until.tv_sec  = now.tv_sec + usec / 1000000;
+  until.tv_nsec = (usec % 1000000) * 1000;
+
+  pthread_cond_timedwait(cond, &wait_mutex, &until);
+}
+
+/**
+ * returns the best gap for the given shard, spins shortly and then 
+ * waits if all shards are empty (NULL after a timeout)
+ *
+ * the number of spins doubles if spinning found a gap, and halves
+ * if the consumer had to wait
+ */
+GapCandidate *GapQueue::wait_pop(sieve_t shard) {
+
+  Shard *own = shards[shard % n_shards];
+
+  for (sieve_t i = 0; i < own->spins; i++) {
+    GapCandidate *gap = pop(shard);
+
+    if (gap != NULL) {
+      if (i > 0 && own->spins < GAP_QUEUE_MAX_SPINS)
+        own->spins *= 2;
+
+      return gap;
+    }
+    __builtin_ia32_pause();
+  }
+
+  if (own->spins > GAP_QUEUE_MIN_SPINS)
+    own->spins /= 2;
+
+  pthread_mutex_lock(&wait_mutex);
+  __sync_fetch_and_add(&n_waiting, 1);
+
+  if (n_gaps == 0)
+    timed_wait(&not_empty, GAP_QUEUE_WAIT_USEC);
+
+  __sync_fetch_and_sub(&n_waiting, 1);
+  pthread_mutex_unlock(&wait_mutex);
+
+  return pop(shard);
+}
+
+/**
+ * whether producers should wait before pushing (never if this is 
+ * empty, since the current slabs of all arenas are charged as well)
+ */
+bool GapQueue::full() {
+  return max_bytes > 0 && !evict && n_gaps > 0 && GapArena::get_bytes() > max_bytes;
+}
+
+/* waits until this is not full (or a timeout) */
+void GapQueue::wait_not_full() {
+
+  pthread_mutex_lock(&wait_mutex);
+  __sync_fetch_and_add(&n_blocked, 1);
+
+  if (full())
+    timed_wait(&not_full, GAP_QUEUE_WAIT_USEC);
+
+  __sync_fetch_and_sub(&n_blocked, 1);
+  pthread_mutex_unlock(&wait_mutex);
+}
+
+/* deletes all gaps */
+void GapQueue::clear() {
+
+  for (sieve_t i = 0; i < n_shards; i++) {
+    pthread_mutex_lock(&shards[i]->mutex);
+
+    GapCandidate *gap;
+    while ((gap = pop_locked(shards[i])) != NULL)
+      GapArena::release(gap);
+
+    pthread_mutex_unlock(&shards[i]->mutex);
+  }
+
+  pthread_mutex_lock(&wait_mutex);
+  pthread_cond_broadcast(&not_full);
+  pthread_mutex_unlock(&wait_mutex);
+}
+
+/* returns the number of gaps within this */
+uint64_t GapQueue::size() {
+  return n_gaps;
+}
+
+/**
+ * returns the candidate count of the median gap
+ * (approximately, since the shards are updated concurrently)
+ */
+sieve_t GapQueue::median() {
+
+  const uint64_t size = n_gaps;
+  if (size == 0)
+    return 0;
+
+  sieve_t median = 0;
+  sieve_t count  = histogram[0];
+  while (count * 2 < size && median < max_candidates)
+    count += histogram[++median];
+
+  return median;
+}
+
+/* returns the number of shards */
+sieve_t GapQueue::get_n_shards() {
+  return n_shards;
+}
@@ -0,0 +1,203 @@
+/**
+ * Header file for a sharded priority queue of GapCandidates
+ * used in the ChineseSieve
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __GAP_QUEUE_H__
+#define __GAP_QUEUE_H__
+
+#include <pthread.h>
+#include <inttypes.h>
+#include <math.h>
+#include <vector>
+#include "GapCandidate.h"
+#include "GapArena.h"
+#include "utils.h"
+
+using namespace std;
+
+/* cache line size, to keep the shards apart */
+#define GAP_QUEUE_CACHE_LINE 64
+
+/* bounds of the adaptive consumer spins before waiting */
+#define GAP_QUEUE_MIN_SPINS 16
+#define GAP_QUEUE_MAX_SPINS 4096
+
+/* maximum wait time in microseconds (to recheck stop conditions) */
+#define GAP_QUEUE_WAIT_USEC 10000
+
+/* best score of an empty shard */
+#define GAP_QUEUE_EMPTY (-HUGE_VALF)
+
+/**
+ * score difference to steal from an other non empty shard 
+ * (a gap twice as likely per test)
+ */
+#define GAP_QUEUE_STEAL_MARGIN ((float) M_LN2)
+
+/**
+ * A priority queue of GapCandidates (highest score first) split into
+ * shards with an own lock each, one per Fermat thread.
+ *
+ * Producers publish batches of gaps round robin into the shards,
+ * consumers pop from there own shard. They steal from the best other
+ * shard if there own is empty, or from an other shard (one per pop, 
+ * round robin) if its best gap is clearly better than there own. 
+ * Each shard caches the score of its best gap, so the global best 
+ * first order is approximately kept without locking other shards.
+ *
+ * The gaps are scored for the current target when they are pushed,
+ * and all are rescored if the target changes.
+ *
+ * The queue can be bounded by a memory budget, if it is exceeded 
+ * producers either wait until the consumers made room, or the worst
+ * gaps are evicted. The budget is charged with all allocated GapSlabs,
+ * and the survivors of an eviction are moved into the own slabs of the
+ * shard, so a few gaps don't keep whole slabs allocated.
+ */
+class GapQueue {
+
+  public:
+
+    /**
+     * creates a new GapQueue for gaps with up to max_candidates,
+     * with the given memory budget in bytes (unbounded if zero)
+     */
+    GapQueue(sieve_t n_shards, 
+             sieve_t max_candidates, 
+             uint64_t max_bytes = 0,
+             bool evict = false);
+
+    ~GapQueue();
+
+    /* scores and publishes the given gaps into the next shard (clears gaps) */
+    void push(vector<GapCandidate *> &gaps);
+
+    /* sets the target to score the gaps with (rescores all if it changed) */
+    void set_target(uint64_t target);
+
+    /* returns the best gap for the given shard (NULL if all are empty) */
+    GapCandidate *pop(sieve_t shard);
+
+    /**
+     * returns the best gap for the given shard, spins shortly and then 
+     * waits if all shards are empty (NULL after a timeout)
+     */
+    GapCandidate *wait_pop(sieve_t shard);
+
+    /* whether producers should wait before pushing */
+    bool full();
+
+    /* waits until this is not full (or a timeout) */
+    void wait_not_full();
+
+    /* deletes all gaps */
+    void clear();
+
+    /* returns the number of gaps within this */
+    uint64_t size();
+
+    /* returns the candidate count of the median gap */
+    sieve_t median();
+
+    /* returns the number of shards */
+    sieve_t get_n_shards();
+
+  private:
+
+    typedef struct {
+      pthread_mutex_t mutex;
+
+      /* the heap of this shard */
+      vector<GapCandidate *> heap;
+
+      /**
+       * score of the best gap (GAP_QUEUE_EMPTY if empty), 
+       * accessed atomically, it's read without the lock
+       */
+      float best;
+
+      /* adaptive number of spins before a consumer of this waits */
+      sieve_t spins;
+
+      /* the slabs the survivors of an eviction are moved to */
+      GapArena *arena;
+
+      /* the other shard the consumer of this checks next */
+      sieve_t victim;
+
+      char padding[GAP_QUEUE_CACHE_LINE];
+    } Shard;
+
+    /* the shards of this */
+    Shard **shards;
+    sieve_t n_shards;
+
+    /* round robin counter of the producers */
+    volatile sieve_t next_shard;
+
+    /* number of gaps within this */
+    volatile uint64_t n_gaps;
+
+    /* the target the gaps are scored with */
+    volatile uint64_t target;
+
+    /* number of gaps per candidate count */
+    sieve_t *histogram;
+    sieve_t max_candidates;
+
+    /* the budget of the GapSlabs in bytes (zero if unbounded) */
+    uint64_t max_bytes;
+
+    /* whether the worst gaps are evicted if the budget is exceeded */
+    bool evict;
+
+    /* wakeups of waiting consumers and producers */
+    pthread_mutex_t wait_mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    /* number of waiting consumers and blocked producers */
+    volatile sieve_t n_waiting;
+    volatile sieve_t n_blocked;
+
+    /* pops the best gap of the given shard (needs the shard lock) */
+    GapCandidate *pop_locked(Shard *shard);
+
+    /* updates the cached best score of the given shard (needs the shard lock) */
+    void update_best(Shard *shard);
+
+    /* returns the cached best score of the given shard */
+    float load_best(Shard *shard);
+
+    /* returns the shard with the best gap, except the given one */
+    Shard *best_other(sieve_t shard);
+
+    /**
+     * evicts the worst gaps of the given shard, and moves the others 
+     * into the slabs of the shard (needs the shard lock)
+     */
+    void evict_locked(Shard *shard);
+
+    /* updates the counters for an added (sign = 1) or removed gap */
+    void count(GapCandidate *gap, int sign);
+
+    /* waits for the given condition at most timeout microseconds */
+    void timed_wait(pthread_cond_t *cond, uint64_t timeout);
+};
+
+#endif /* __GAP_QUEUE_H__ */
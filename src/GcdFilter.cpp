@@ -0,0 +1,173 @@
+/**
+ * Implementation of a batch gcd filter of the prime candidates against
+ * the primes above the sieve limit
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "GcdFilter.h"
+
+/* maximum height of a product tree */
+#define GCD_FILTER_MAX_LEVELS 64
+
+/* creates a filter for the n_band primes following the first n_skip primes */
+GcdFilter::GcdFilter(uint64_t n_skip, uint64_t n_band) {
+
+  log_str("creating GcdFilter for " + itoa(n_band) + " primes after " +
+          itoa(n_skip) + " primes", LOG_D);
+
+  uint32_t *primes = first_primes(n_skip + n_band);
+
+  /* multiply the band primes pairwise up to the root */
+  sieve_t n = (n_band > 0) ? n_band : 1;
+  mpz_t *tree = (mpz_t *) malloc(sizeof(mpz_t) * n);
+
+  for (sieve_t i = 0; i < n; i++)
+    mpz_init_set_ui(tree[i], (n_band > 0) ? primes[n_skip + i] : 1);
+
+  for (; n > 1; n = (n + 1) / 2) {
+    for (sieve_t i = 0; i < n / 2; i++)
+      mpz_mul(tree[i], tree[2 * i], tree[2 * i + 1]);
+
+    if (n & 1)
+      mpz_swap(tree[n / 2], tree[n - 1]);
+  }
+
+  mpz_init_set(mpz_product, tree[0]);
+  log_str("GcdFilter product has " + itoa(mpz_sizeinbase(mpz_product, 2)) +
+          " bits", LOG_D);
+
+  for (sieve_t i = 0; i < ((n_band > 0) ? n_band : 1); i++)
+    mpz_clear(tree[i]);
+
+  free(tree);
+  free(primes);
+}
+
+GcdFilter::~GcdFilter() {
+  mpz_clear(mpz_product);
+}
+
+/* returns the first n primes */
+uint32_t *GcdFilter::first_primes(uint64_t n) {
+
+  /* p_n < n (ln n + ln ln n) for n >= 6 */
+  const uint64_t limit = (n < 6) ? 16 : (uint64_t) (n * (log(n) + log(log(n)))) + 1;
+
+  /* odd only sieve of Eratosthenes */
+  uint8_t *composite = (uint8_t *) calloc(limit / 2 + 1, 1);
+  uint32_t *primes   = (uint32_t *) malloc(sizeof(uint32_t) * (n + 1));
+  uint64_t i = 0;
+
+  if (n > 0)
+    primes[i++] = 2;
+
+  for (uint64_t p = 3; i < n && p <= limit; p += 2) {
+    if (composite[p / 2])
+      continue;
+
+    primes[i++] = p;
+    for (uint64_t m = p * p; m <= limit; m += 2 * p)
+      composite[m / 2] = 1;
+  }
+
+  free(composite);
+  return primes;
+}
+
+/**
+ * marks the numbers with a factor in the band as composite
+ * (the others are not changed)
+ *
+ * the numbers are split into trees with a product about the size
+ * of the band product, since higher trees only cost multiplications
+ * without reducing the band product any further
+ */
+void GcdFilter::filter(mpz_ptr *mpz_numbers, bool *composite, sieve_t n) {
+
+  if (n == 0)
+    return;
+
+  const sieve_t ratio = mpz_sizeinbase(mpz_product, 2) / mpz_sizeinbase(mpz_numbers[0], 2);
+  sieve_t size = 1;
+  while (size * 2 <= ratio)
+    size *= 2;
+
+  for (sieve_t i = 0; i < n; i += size)
+    filter_tree(mpz_numbers + i, composite + i, (i + size < n) ? size : n - i);
+}
+
+/* filters the given numbers with one remainder tree */
+void GcdFilter::filter_tree(mpz_ptr *mpz_numbers, bool *composite, sieve_t n) {
+
+  /* the product tree, level zero are the numbers itself */
+  mpz_t *levels[GCD_FILTER_MAX_LEVELS];
+  sieve_t sizes[GCD_FILTER_MAX_LEVELS];
+  sieve_t top = 0;
+  sizes[0] = n;
+
+  while (sizes[top] > 1) {
+    const sieve_t size = (sizes[top] + 1) / 2;
+    levels[top + 1] = (mpz_t *) malloc(sizeof(mpz_t) * size);
+
+    for (sieve_t i = 0; i < size; i++) {
+      mpz_init(levels[top + 1][i]);
+
+      mpz_srcptr a = (top == 0) ? mpz_numbers[2 * i] : levels[top][2 * i];
+      if (2 * i + 1 < sizes[top]) {
+        mpz_srcptr b = (top == 0) ? mpz_numbers[2 * i + 1] : levels[top][2 * i + 1];
+        mpz_mul(levels[top + 1][i], a, b);
+      } else
+        mpz_set(levels[top + 1][i], a);
+    }
+
+    sizes[++top] = size;
+  }
+
+  /* the remainder tree (reuses the product tree from the top down) */
+  mpz_t mpz_rem;
+  mpz_init(mpz_rem);
+
+  if (top > 0) {
+    mpz_mod(levels[top][0], mpz_product, levels[top][0]);
+
+    for (sieve_t l = top - 1; l > 0; l--)
+      for (sieve_t i = 0; i < sizes[l]; i++)
+        mpz_mod(levels[l][i], levels[l + 1][i / 2], levels[l][i]);
+  }
+
+  for (sieve_t i = 0; i < n; i++) {
+    if (top > 0)
+      mpz_mod(mpz_rem, levels[1][i / 2], mpz_numbers[i]);
+    else
+      mpz_mod(mpz_rem, mpz_product, mpz_numbers[i]);
+
+    mpz_gcd(mpz_rem, mpz_rem, mpz_numbers[i]);
+    if (mpz_cmp_ui(mpz_rem, 1) != 0)
+      composite[i] = true;
+  }
+
+  mpz_clear(mpz_rem);
+
+  for (sieve_t l = 1; l <= top; l++) {
+    for (sieve_t i = 0; i < sizes[l]; i++)
+      mpz_clear(levels[l][i]);
+
+    free(levels[l]);
+  }
+}
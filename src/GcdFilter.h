@@ -0,0 +1,70 @@
+/**
+ * Header file of a batch gcd filter of the prime candidates against
+ * the primes above the sieve limit
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __GCD_FILTER_H__
+#define __GCD_FILTER_H__
+
+#include <gmp.h>
+#include <inttypes.h>
+#include "utils.h"
+
+/* numbers filtered at once (the product should be about the size of the primes product) */
+#define GCD_FILTER_BATCH 4096
+
+/**
+ * Removes the candidates with a factor in a band of primes above the
+ * sieve limit, before they are Fermat tested.
+ *
+ * The product P of the band primes is calculated once. For a batch
+ * of candidates N_i a product tree is build, and P is reduced down
+ * the tree (a remainder tree), so that each leaf holds P mod N_i.
+ * A candidate has a factor in the band if gcd(P mod N_i, N_i) > 1.
+ *
+ * The cost per candidate is a few multiplications of the batch size,
+ * so this only pays off if the candidates are many compared to the
+ * primes of the band, i.e. if the sieve is shallow.
+ */
+class GcdFilter {
+
+  public:
+
+    /* creates a filter for the n_band primes following the first n_skip primes */
+    GcdFilter(uint64_t n_skip, uint64_t n_band);
+
+    ~GcdFilter();
+
+    /**
+     * marks the numbers with a factor in the band as composite
+     * (the others are not changed)
+     */
+    void filter(mpz_ptr *mpz_numbers, bool *composite, sieve_t n);
+
+  private:
+
+    /* the product of the band primes */
+    mpz_t mpz_product;
+
+    /* filters the given numbers with one remainder tree */
+    void filter_tree(mpz_ptr *mpz_numbers, bool *composite, sieve_t n);
+
+    /* returns the first n primes */
+    static uint32_t *first_primes(uint64_t n);
+};
+
+#endif /* __GCD_FILTER_H__ */
@@ -16,7 +16,6 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#ifndef CPU_ONLY
 #ifndef __STDC_FORMAT_MACROS 
 #define __STDC_FORMAT_MACROS 
 #endif
@@ -35,6 +34,7 @@
 #include "utils.h"
 #include "HybridSieve.h"
 #include "Opts.h"
+#include "FermatBackend.h"
 
 #if __WORDSIZE == 64
 /**
@@ -78,6 +78,23 @@
  */
 #define set_composite(ary, i) set_bit(ary, i)
 
+#ifdef ODD_SIEVE
+/**
+ * the sieve only holds the odd offsets (the even ones are never prime),
+ * offset i is at bit i / 2
+ */
+#define sieve_index(i) ((i) >> 1)
+#define SIEVE_OFFSETS_PER_BIT 2
+#define extract_sieve_candidates extract_odd_candidates
+#else
+/**
+ * the sieve holds every offset
+ */
+#define sieve_index(i) (i)
+#define SIEVE_OFFSETS_PER_BIT 1
+#define extract_sieve_candidates extract_candidates
+#endif
+
 /**
  * sets x to the next greater number divisible by y
  */
@@ -118,12 +135,46 @@ HybridSieve::HybridSieve(PoWProcessor *pprocessor,
   this->work_items       = work_items;
   this->passed_time      = 1;
   this->cur_passed_time  = 1;
+
+  /* segments are a multiple of 512 bits, so they start at a cache line */
+  this->segment_size = (l2_cache_size() * 4 * SIEVE_OFFSETS_PER_BIT) & ~((sieve_t) 511);
+  if (segment_size == 0 || segment_size > sievesize)
+    this->segment_size = sievesize;
+
+  calc_patterns();
+
+  this->n_segment_primes = n_pattern_primes;
+  while (n_segment_primes < n_primes && primes[n_segment_primes] < segment_size)
+    n_segment_primes++;
+
+  log_str("sieving in segments of " + itoa(segment_size) + " bits with " +
+          itoa(n_segment_primes) + " primes", LOG_D);
+
+  /**
+   * primes with a step of at least two rounds go into buckets, they 
+   * hit at most every second round
+   */
+  this->bucket_start = n_segment_primes;
+  while (bucket_start < n_primes && primes[bucket_start] < sievesize)
+    bucket_start++;
+
+  /* the next hit is at most sievesize + 2 * largest prime away */
+  this->n_buckets = 1;
+  while (n_buckets * sievesize <= sievesize + 2 * primes[n_primes - 1])
+    n_buckets *= 2;
+
+  this->buckets     = (BucketChunk **) calloc(n_buckets, sizeof(BucketChunk *));
+  this->free_chunks = NULL;
+
+  log_str("sieving " + itoa(n_primes - bucket_start) + " primes with " +
+          itoa(n_buckets) + " buckets", LOG_D);
+
   this->gpu_list = new GPUWorkList(work_items * gpu_groub_size / n_tests, 
                                    n_tests, 
                                    pprocessor, 
                                    this, 
-                                   GPUFermat::get_instance()->get_prime_base_buffer(),
-                                   GPUFermat::get_instance()->get_candidates_buffer(),
+                                   HybridFermat::get_instance()->get_prime_base_buffer(),
+                                   HybridFermat::get_instance()->get_candidates_buffer(),
                                    &tests,
                                    &cur_tests);
 
@@ -153,6 +204,15 @@ HybridSieve::~HybridSieve() {
   delete sieve_queue;
   delete gpu_list;
 
+  for (sieve_t i = 0; i < chunks.size(); i++)
+    free(chunks[i]);
+
+  for (sieve_t i = 0; i < n_patterns; i++)
+    free(patterns[i].words);
+
+  free(buckets);
+  free(patterns);
+
   free(candidates_template);
 }
 
@@ -204,6 +264,10 @@ void HybridSieve::run_sieve(PoW *pow,
   /* calculates for each prime, the first index in the sieve
    * which is divisible by that prime */
   calc_muls();
+  init_buckets();
+
+  for (sieve_t i = 0; i < n_patterns; i++)
+    patterns[i].offset = mpz_tdiv_ui(mpz_start, 2 * patterns[i].period);
 
   /* run the sieve till stop signal arrives */
   for (sieve_t sieve_round = 0; 
@@ -221,22 +285,50 @@ void HybridSieve::run_sieve(PoW *pow,
     }
     
 
-    /* clear the sieve */
-    memset(sieve, 0, sievesize / 8);
+    /**
+     * sieve the small primes (skip 2) segment by segment, so that the 
+     * sieve stays within the cache, starts holds the next multiple
+     */
+    for (sieve_t low = 0; low < sievesize; low += segment_size) {
+      const sieve_t high = (low + segment_size < sievesize) ? low + segment_size : sievesize;
+
+      memset(((uint8_t *) sieve) + sieve_index(low) / 8, 
+             0, 
+             (sieve_index(high) - sieve_index(low)) / 8);
+      sieve_patterns(low, high);
 
-    /* sieve all small primes (skip 2) */
-    for (sieve_t i = 1; i < n_primes; i++) {
+      for (sieve_t i = n_pattern_primes; i < n_segment_primes; i++) {
+
+        /**
+         * sieve all odd multiplies of the current prime
+         */
+        sieve_t p;
+        for (p = starts[i]; p < high; p += primes2[i])
+          set_composite(sieve, sieve_index(p));
+
+        starts[i] = p;
+      }
+    }
+
+    for (sieve_t i = n_pattern_primes; i < n_segment_primes; i++)
+      starts[i] -= sievesize;
+
+    for (sieve_t i = 0; i < n_patterns; i++)
+      patterns[i].offset = (patterns[i].offset + sievesize) % (2 * patterns[i].period);
+
+    /* the larger primes hit a segment at most once */
+    for (sieve_t i = n_segment_primes; i < bucket_start; i++) {
 
-      /**
-       * sieve all odd multiplies of the current prime
-       */
       sieve_t p;
       for (p = starts[i]; p < sievesize; p += primes2[i])
-        set_composite(sieve, p);
+        set_composite(sieve, sieve_index(p));
 
       starts[i] = p - sievesize;
     }
 
+    /* and the largest only some rounds */
+    bucket_sieve(sieve_round);
+
     if (!should_stop(hash)) 
       sieve_queue->push(new SieveItem(sieve, sievesize, sieve_round, hash, mpz_start, pow));
 
@@ -257,12 +349,12 @@ HybridSieve::SieveItem::SieveItem(sieve_t *sieve,
                                   mpz_t mpz_start,
                                   PoW *pow) {
 
-  this->sieve       = (sieve_t *) malloc(sievesize / 8);
+  this->sieve       = (sieve_t *) malloc(sieve_index(sievesize) / 8);
   this->sievesize   = sievesize;
   this->sieve_round = sieve_round;
   this->pow         = pow;
   mpz_init_set(this->mpz_start, mpz_start);
-  memcpy(this->sieve, sieve, sievesize / 8);
+  memcpy(this->sieve, sieve, sieve_index(sievesize) / 8);
   memcpy(this->hash,  hash,  SHA256_DIGEST_LENGTH);
 }
 
@@ -377,13 +469,12 @@ void *HybridSieve::gpu_work_thread(void *args) {
   HybridSieve::GPUWorkList *gpu_list = queue->gpu_list;
   uint32_t offset_template[1024];
 
-  mpz_t mpz_p, mpz_e, mpz_r, mpz_two, mpz_start;
+  mpz_t mpz_p, mpz_start;
   mpz_init_set_ui64(mpz_p, 0);
-  mpz_init_set_ui64(mpz_e, 0);
-  mpz_init_set_ui64(mpz_r, 0);
-  mpz_init_set_ui64(mpz_two, 2);
   mpz_init_set_ui64(mpz_start, 0);
 
+  /* the fastest Fermat test of single numbers with the width of the prime base */
+  FermatBackend *fermat = FermatBackend::create_fastest(gpu_op_size * 32, false);
 
   while (queue->running) {
 
@@ -395,7 +486,7 @@ void *HybridSieve::gpu_work_thread(void *args) {
     mpz_set(mpz_start, sitem->mpz_start);
 
     double d_difficulty = ((double) pow->get_target()) / TWO_POW48;
-    sieve_t min_len     = log_str(mpz_get_d(mpz_start)) * d_difficulty;
+    sieve_t min_len     = log(mpz_get_d(mpz_start)) * d_difficulty;
     sieve_t start       = 0;
     sieve_t i           = 1;
 
@@ -414,14 +505,16 @@ void *HybridSieve::gpu_work_thread(void *args) {
 
     /* Locate the first prime */
     for ( ; i < sievesize; i += 2) {
-      if (is_prime(sieve, i)) {
+      if (is_prime(sieve, sieve_index(i))) {
   
         /* run fermat test */
         mpz_add_ui(mpz_p, mpz_start, i + sievesize * sieve_round);
-        mpz_sub_ui(mpz_e, mpz_p, 1);
-        mpz_powm(mpz_r, mpz_two, mpz_e, mpz_p);
+
+        mpz_ptr mpz_ptr_p = mpz_p;
+        bool found_prime;
+        fermat->fermat_test(&mpz_ptr_p, &found_prime, 1);
    
-        if (mpz_cmp_ui(mpz_r, 1) == 0) {
+        if (found_prime) {
           i += 2;
           break;
         }
@@ -433,14 +526,11 @@ void *HybridSieve::gpu_work_thread(void *args) {
     /* run the sieve in size of min_len */
     for (; i < sievesize - min_len && !hsieve->should_stop(sitem->hash); i += min_len) {
 
-      sieve_t p = 0;
-      for (sieve_t n = 0; n < min_len; n += 2) {
-
-        if (is_prime(sieve, (i + n))) {
-          offset_template[p] = i + n + sievesize * sieve_round;
-          p++;
-        }
-      }
+      sieve_t p = extract_sieve_candidates(sieve, 
+                                     i, 
+                                     i + min_len, 
+                                     sievesize * sieve_round, 
+                                     offset_template);
 
       gpu_list->add(new GPUWorkItem(offset_template, p, min_len, start));
       start = 0;
@@ -458,10 +548,8 @@ void *HybridSieve::gpu_work_thread(void *args) {
     delete sitem;
   }
 
+  delete fermat;
   mpz_clear(mpz_p);
-  mpz_clear(mpz_e);
-  mpz_clear(mpz_r);
-  mpz_clear(mpz_two);
   mpz_clear(mpz_start);
   return NULL;
 }
@@ -485,7 +573,7 @@ void *HybridSieve::gpu_results_thread(void *args) {
 #endif
 
   GPUWorkList *list = (GPUWorkList *) args;
-  GPUFermat *fermat = GPUFermat::get_instance();
+  HybridFermat *fermat = HybridFermat::get_instance();
   uint32_t *result  = fermat->get_results_buffer();
 
   while (list->running) {
@@ -1016,6 +1104,153 @@ void HybridSieve::GPUWorkList::parse_results(uint32_t *results) {
   }
 }
 
+/**
+ * groups the small primes into patterns
+ *
+ * A number start + b is divisible by a prime p of a group with product q
+ * if b = -start mod p, so the marks of all primes of the group only 
+ * depend on start % 2q (start is even). The pattern holds the marks for
+ * start = 0 and is shifted by start % 2q bits. The patterns need whole
+ * 64 bit words, otherwise all primes are sieved bit by bit.
+ */
+void HybridSieve::calc_patterns() {
+
+  this->patterns         = (SievePattern *) malloc(sizeof(SievePattern) * HYBRID_PATTERN_LIMIT);
+  this->n_patterns       = 0;
+  this->n_pattern_primes = 1;
+
+#if __WORDSIZE == 64
+  if (sieve_index(sievesize) % 64 != 0)
+    return;
+
+  sieve_t i = 1;
+  while (i < n_primes && primes[i] < HYBRID_PATTERN_LIMIT) {
+
+    SievePattern *pattern = patterns + n_patterns++;
+    const sieve_t first   = i;
+
+    pattern->period = 1;
+    while (i < n_primes && 
+           primes[i] < HYBRID_PATTERN_LIMIT &&
+           pattern->period * primes[i] <= HYBRID_PATTERN_WORDS) {
+
+      pattern->period *= primes[i++];
+    }
+
+    /* the odd multiples of the primes */
+    pattern->words = (sieve_t *) calloc(pattern->period + 1, sizeof(sieve_t));
+    for (sieve_t j = first; j < i; j++)
+      for (sieve_t p = primes[j]; sieve_index(p) < pattern->period * 64; p += primes2[j])
+        set_composite(pattern->words, sieve_index(p));
+
+    /* so that the shifted words don't need to wrap */
+    pattern->words[pattern->period] = pattern->words[0];
+  }
+  this->n_pattern_primes = i;
+
+  log_str("sieving " + itoa(n_pattern_primes - 1) + " primes with " +
+          itoa(n_patterns) + " patterns", LOG_D);
+#endif
+}
+
+/* ors the patterns into the sieve bits [low, high) */
+void HybridSieve::sieve_patterns(sieve_t low, sieve_t high) {
+
+  sieve_t *words = sieve + sieve_index(low) / 64;
+  const sieve_t n_words = (sieve_index(high) - sieve_index(low)) / 64;
+
+  for (sieve_t i = 0; i < n_patterns; i++) {
+
+    const sieve_t period = patterns[i].period;
+    const sieve_t *pattern = patterns[i].words;
+    const sieve_t shift = sieve_index(patterns[i].offset) % 64;
+    sieve_t j = (sieve_index(low) / 64 + sieve_index(patterns[i].offset) / 64) % period;
+
+    for (sieve_t k = 0; k < n_words; j = 0) {
+      const sieve_t end = (k + period - j < n_words) ? k + period - j : n_words;
+
+      if (shift == 0) {
+        for (; k < end; k++, j++)
+          words[k] |= pattern[j];
+      } else {
+        for (; k < end; k++, j++)
+          words[k] |= (pattern[j] >> shift) | (pattern[j + 1] << (64 - shift));
+      }
+    }
+  }
+}
+
+/* adds a hit (offset) of prime index i jump rounds after the given round */
+inline void HybridSieve::bucket_add(sieve_t i, 
+                                    sieve_t round, 
+                                    sieve_t jump, 
+                                    uint32_t offset) {
+
+  BucketEntry entry;
+  entry.index  = i;
+  entry.offset = offset;
+
+  BucketChunk **bucket = buckets + ((round + jump) & (n_buckets - 1));
+  if (*bucket == NULL || (*bucket)->size == HYBRID_BUCKET_CHUNK_SIZE) {
+    
+    BucketChunk *chunk = free_chunks;
+    if (chunk != NULL) {
+      free_chunks = chunk->next;
+    } else {
+      chunk = (BucketChunk *) malloc(sizeof(BucketChunk));
+      chunks.push_back(chunk);
+    }
+
+    chunk->next = *bucket;
+    chunk->size = 0;
+    *bucket     = chunk;
+  }
+
+  (*bucket)->entries[(*bucket)->size++] = entry;
+}
+
+/* puts all bucket sieved primes into the bucket of there first hit */
+void HybridSieve::init_buckets() {
+
+  /* recycle all chunks */
+  for (sieve_t b = 0; b < n_buckets; b++) {
+    while (buckets[b] != NULL) {
+      BucketChunk *chunk = buckets[b];
+      buckets[b]  = chunk->next;
+      chunk->next = free_chunks;
+      free_chunks = chunk;
+    }
+  }
+
+  for (sieve_t i = bucket_start; i < n_primes; i++)
+    bucket_add(i, 0, starts[i] / sievesize, starts[i] % sievesize);
+}
+
+/* sieves the hits of all bucket sieved primes within the given round */
+void HybridSieve::bucket_sieve(sieve_t round) {
+
+  BucketChunk **bucket = buckets + (round & (n_buckets - 1));
+  BucketChunk *chunk = *bucket;
+  *bucket = NULL;
+
+  while (chunk != NULL) {
+    for (uint32_t e = 0; e < chunk->size; e++) {
+      const BucketEntry entry = chunk->entries[e];
+
+      set_composite(sieve, sieve_index(entry.offset));
+
+      /* the step is at least a round, so the next hit is in a later one */
+      const sieve_t next = entry.offset + primes2[entry.index];
+      bucket_add(entry.index, round, next / sievesize, next % sievesize);
+    }
+
+    BucketChunk *next = chunk->next;
+    chunk->next = free_chunks;
+    free_chunks = chunk;
+    chunk       = next;
+  }
+}
+
 /**
  * calculate for every prime the first
  * index in the sieve which is divisible by that prime
@@ -1189,5 +1424,3 @@ uint32_t HybridSieve::GPUWorkList::get_xor() {
 /* returns the current prime_base of this */
 uint32_t *HybridSieve::GPUWorkList::get_prime_base() { return prime_base; }
 #endif /* DEBUG_BASIC */
-
-#endif /* CPU_ONLY */
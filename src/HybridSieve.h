@@ -16,7 +16,6 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#ifndef CPU_ONLY
 #ifndef __HYBRID_SIEVE_H__
 #define __HYBRID_SIEVE_H__
 #include <inttypes.h>
@@ -26,14 +25,35 @@
 #include <gmp.h>
 #include <mpfr.h>
 #include <queue>
+#include <vector>
 
 #include "PoWCore/src/PoW.h"
 #include "PoWCore/src/PoWUtils.h"
 #include "PoWCore/src/PoWProcessor.h"
 #include "PoWCore/src/Sieve.h"
-#include "GPUFermat.h"
 #include "Opts.h"
 
+/* the batched Fermat test (on cpu threads if there is no gpu support) */
+#ifndef CPU_ONLY
+#include "GPUFermat.h"
+typedef GPUFermat HybridFermat;
+#else
+#include "CPUFermat.h"
+typedef CPUFermat HybridFermat;
+#endif
+
+/* number of entries within a bucket chunk of the HybridSieve */
+#define HYBRID_BUCKET_CHUNK_SIZE 1024
+
+/**
+ * primes below this are sieved with precalculated patterns, larger ones
+ * hit less than once per two words
+ */
+#define HYBRID_PATTERN_LIMIT 64
+
+/* maximum number of words of a pattern */
+#define HYBRID_PATTERN_WORDS (1 << 13)
+
 using namespace std;
 
 class HybridSieve : public Sieve {
@@ -88,6 +108,77 @@ class HybridSieve : public Sieve {
 
     /* template array for the Fermat candidates */
     uint64_t *candidates_template;
+
+    /* bits of the sieve which are sieved at once (half of the level 2 cache) */
+    sieve_t segment_size;
+
+    /* number of primes smaller than a segment (they are sieved per segment) */
+    sieve_t n_segment_primes;
+
+    /**
+     * the odd multiples of a group of small primes with the product q,
+     * they repeat every 2q offsets, so the words repeat every q words
+     */
+    typedef struct {
+      sieve_t period;
+
+      /* the pattern for a start divisible by 2q (period + 1 words) */
+      sieve_t *words;
+
+      /* start of the current round % 2q */
+      sieve_t offset;
+    } SievePattern;
+
+    /* the patterns of the small primes */
+    SievePattern *patterns;
+    sieve_t n_patterns;
+
+    /* number of primes (including 2) which are sieved by the patterns */
+    sieve_t n_pattern_primes;
+
+    /* groups the small primes into patterns */
+    void calc_patterns();
+
+    /* ors the patterns into the sieve bits [low, high) */
+    void sieve_patterns(sieve_t low, sieve_t high);
+
+    /* a sieve hit of a large prime: the prime index and the offset in the round */
+    typedef struct {
+      uint32_t index;
+      uint32_t offset;
+    } BucketEntry;
+
+    /* entries of a bucket are stored in linked chunks */
+    typedef struct BucketChunk {
+      struct BucketChunk *next;
+      uint32_t size;
+      BucketEntry entries[HYBRID_BUCKET_CHUNK_SIZE];
+    } BucketChunk;
+
+    /**
+     * index of the first bucket sieved prime, these primes hit at most
+     * every second round, so they are only touched in the rounds they hit
+     */
+    sieve_t bucket_start;
+
+    /* number of buckets (rounds ahead), a power of two */
+    sieve_t n_buckets;
+
+    /* the bucket ring, one chunk list for each upcoming round */
+    BucketChunk **buckets;
+
+    /* recycled chunks, and all allocated chunks */
+    BucketChunk *free_chunks;
+    vector<BucketChunk *> chunks;
+
+    /* puts all bucket sieved primes into the bucket of there first hit */
+    void init_buckets();
+
+    /* adds a hit (offset) of prime index i jump rounds after the given round */
+    inline void bucket_add(sieve_t i, sieve_t round, sieve_t jump, uint32_t offset);
+
+    /* sieves the hits of all bucket sieved primes within the given round */
+    void bucket_sieve(sieve_t round);
     
     /* one GPU work item (set of prime candidates for a prime gap */
     class GPUWorkItem {
@@ -418,4 +509,3 @@ class HybridSieve : public Sieve {
 
 };
 #endif /* __HYBRID_SIEVE_H__ */
-#endif /* CPU_ONLY */
@@ -39,6 +39,15 @@
 /* synchronization mutex */
 pthread_mutex_t Miner::mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* whether to use the HybridSieve (on cpu threads if there is no gpu support) */
+static bool use_hybrid_sieve() {
+#ifndef CPU_ONLY
+  return Opts::get_instance()->has_use_gpu();
+#else
+  return Opts::get_instance()->has_hybrid_sieve();
+#endif
+}
+
 /* create a new miner */
 Miner::Miner(uint64_t sieve_size, 
              uint64_t sieve_primes, 
@@ -51,20 +60,17 @@ Miner::Miner(uint64_t sieve_size,
   this->running        = false;
   this->is_started     = false;
   this->use_chinese    = Opts::get_instance()->has_cset(); 
+  this->cset           = NULL;
   this->fermat_threads = 1;
   if (Opts::get_instance()->has_fermat_threads())
     this->fermat_threads = atoi(Opts::get_instance()->get_fermat_threads().c_str());
-#ifndef CPU_ONLY  
-  this->use_gpu        = Opts::get_instance()->has_use_gpu(); 
-#endif  
+  this->use_hybrid     = use_hybrid_sieve();
 
   threads      = (pthread_t *)   calloc(n_threads, sizeof(pthread_t));
   args         = (ThreadArgs **) calloc(n_threads, sizeof(ThreadArgs *));
 
-#ifndef CPU_ONLY  
-  if (use_gpu)
+  if (use_hybrid)
     this->n_threads = 1;
-#endif    
 }              
 
 /* start processing */
@@ -73,13 +79,11 @@ void Miner::start(BlockHeader *header) {
   log_str("starting Miner", LOG_D);
   running = true;
   Opts *opts = Opts::get_instance();
-#ifndef CPU_ONLY
-  bool use_gpu = opts->has_use_gpu(); 
+  bool use_hybrid = use_hybrid_sieve();
 
   uint64_t n_tests    = (opts->has_n_tests() ? atoi(opts->get_n_tests().c_str()) : 8);
   uint64_t work_items = (opts->has_work_items() ? atoi(opts->get_work_items().c_str()) : 512);
   uint64_t queue_size = (opts->has_queue_size() ? atoi(opts->get_queue_size().c_str()) : 10);
-#endif
 
   ShareProcessor *share_processor = ShareProcessor::get_processor();
   share_processor->update_header(header);
@@ -97,8 +101,7 @@ void Miner::start(BlockHeader *header) {
                              &running, 
                              header);
     
-#ifndef CPU_ONLY
-    if (use_gpu) {
+    if (use_hybrid) {
       args[i]->hsieve = new HybridSieve((PoWProcessor *) share_processor, 
                                         sieve_primes, 
                                         sieve_size,
@@ -111,10 +114,18 @@ void Miner::start(BlockHeader *header) {
              SHA256_DIGEST_LENGTH);
              
     } else {
-#endif
       if (use_chinese) {
         
-        ChineseSet *cset = new ChineseSet(opts->get_cset().c_str());
+        /* the ChineseSet is read only, so all threads share one */
+        if (cset == NULL) {
+          cset = new ChineseSet(opts->get_cset().c_str());
+
+          /* one thread finalizes the shares of all Fermat threads */
+          ChineseSieve::start_share_thread((PoWProcessor *) share_processor, 
+                                           sieve_primes, 
+                                           cset);
+        }
+
         args[i]->csieve = new ChineseSieve((PoWProcessor *) share_processor, 
                                            sieve_primes, 
                                            cset);
@@ -124,9 +135,7 @@ void Miner::start(BlockHeader *header) {
                                    sieve_primes, 
                                    sieve_size);
       }
-#ifndef CPU_ONLY
     }
-#endif
     
     pthread_create(&threads[i], NULL, miner, (void *) args[i]);
 
@@ -144,45 +153,49 @@ void Miner::start(BlockHeader *header) {
 Miner::~Miner() {
   log_str("deleting Miner", LOG_D);
   stop();
+
+  if (cset != NULL)
+    delete cset;
 }
 
 /* stops all threads and waits until they are finished */
 void Miner::stop() {
 
   log_str("stopping Miner", LOG_D);
-#ifndef CPU_ONLY
-  bool use_gpu = Opts::get_instance()->has_use_gpu(); 
-#endif
+  bool use_hybrid = use_hybrid_sieve();
   bool use_chinese = Opts::get_instance()->has_cset(); 
 
   if (running) {
     running = false;
     
+    /* stop all threads first, the Fermat threads test the gaps of the others */
     for (int i = 0; i < n_threads; i++) {
 
-#ifndef CPU_ONLY
-      if (use_gpu)
+      if (use_hybrid)
         args[i]->hsieve->stop();
-#endif
 
       if (use_chinese)
         args[i]->csieve->stop();
+    }
 
+    for (int i = 0; i < n_threads; i++)
       pthread_join(threads[i], NULL);
+
+    /* the share thread gets the gaps of the Fermat threads */
+    if (use_chinese)
+      ChineseSieve::stop_share_thread();
+
+    for (int i = 0; i < n_threads; i++) {
       delete args[i]->header;
 
-#ifndef CPU_ONLY
-      if (use_gpu)
+      if (use_hybrid)
         delete args[i]->hsieve;
       else {
-#endif
         if (use_chinese)
           delete args[i]->csieve;
         else
           delete args[i]->sieve;
-#ifndef CPU_ONLY
       }
-#endif
     }
   }
 }
@@ -193,24 +206,20 @@ bool Miner::update_header(BlockHeader *header) {
   if (!is_started) return false;
   log_str("updating BlockHeader", LOG_D);
 
-#ifndef CPU_ONLY
-  bool use_gpu = Opts::get_instance()->has_use_gpu(); 
-#endif
+  bool use_hybrid = use_hybrid_sieve();
   bool use_chinese = Opts::get_instance()->has_cset(); 
   
   if (!running)
     return false;
 
-#ifndef CPU_ONLY
   /* restart sieve  with new header */
-  for (int i = 0; use_gpu && i < n_threads; i++) {
+  for (int i = 0; use_hybrid && i < n_threads; i++) {
       memcpy(args[i]->hsieve->hash_prev_block, 
              header->hash_prev_block,
              SHA256_DIGEST_LENGTH);
 
       args[i]->hsieve->stop();
   }
-#endif
 
   /* restart sieve  with new header */
   if (use_chinese) {
@@ -262,16 +271,14 @@ void *Miner::miner(void *args) {
   
   ThreadArgs *targs = (ThreadArgs *) args;
   log_str("Miner thread " + itoa(targs->id) + " started", LOG_D);
-#ifndef CPU_ONLY
-  bool use_gpu = Opts::get_instance()->has_use_gpu(); 
-#endif
+  bool use_hybrid = use_hybrid_sieve();
   bool use_chinese = Opts::get_instance()->has_cset(); 
   int fermat_threads = 1;
   if (Opts::get_instance()->has_fermat_threads())
     fermat_threads = atoi(Opts::get_instance()->get_fermat_threads().c_str());
 
   if (use_chinese && targs->id < fermat_threads) {
-    targs->csieve->run_fermat();
+    targs->csieve->run_fermat(targs->running);
     return NULL;
   }
     
@@ -303,39 +310,23 @@ void *Miner::miner(void *args) {
             targs->header->target, 
             targs->header->nonce);
 
-#ifndef CPU_ONLY
-    if (use_gpu)
+    if (use_hybrid)
       targs->hsieve->run_sieve(&pow, NULL, hash_prev_block);
     else {
-#endif
       if (use_chinese)
         targs->csieve->run_sieve(&pow, hash_prev_block);
       else        
         targs->sieve->run_sieve(&pow, NULL);
-#ifndef CPU_ONLY
     }
-#endif
 
     pthread_mutex_lock(&mutex);
     targs->header->nonce += targs->n_threads;
     pthread_mutex_unlock(&mutex);
   }
   
+  /* the sieves are deleted by Miner::stop */
   mpz_clear(mpz_hash);
 
-#ifndef CPU_ONLY
-  if (use_gpu)
-    delete targs->hsieve;
-  else {
-#endif
-    if (use_chinese)
-      delete targs->csieve;
-    else
-      delete targs->sieve;
-#ifndef CPU_ONLY
-  }
-#endif
-
   log_str("Miner thread " + itoa(targs->id) + " stopped", LOG_D);
   return NULL;
 }
@@ -349,18 +340,14 @@ double Miner::avg_primes_per_sec() {
   
   double apps = 0;
   for (int i = 0; i < n_threads; i++)
-#ifndef CPU_ONLY
-    if (use_gpu)
+    if (use_hybrid)
       apps += args[i]->hsieve->avg_primes_per_sec();
     else {
-#endif
       if (use_chinese) 
         apps += args[i]->csieve->avg_primes_per_sec();
       else 
         apps  += args[i]->sieve->avg_primes_per_sec();
-#ifndef CPU_ONLY
     }
-#endif
 
   return apps;
 }
@@ -374,18 +361,14 @@ double Miner::primes_per_sec() {
   
   double pps = 0;
   for (int i = 0; i < n_threads; i++)
-#ifndef CPU_ONLY
-    if (use_gpu)
+    if (use_hybrid)
       pps += args[i]->hsieve->primes_per_sec();
     else {
-#endif    
       if (use_chinese) 
         pps += args[i]->csieve->primes_per_sec();
       else 
         pps += args[i]->sieve->primes_per_sec();
-#ifndef CPU_ONLY
     }
-#endif
 
   return pps;
 }
@@ -399,18 +382,14 @@ double Miner::avg_gaps_per_second() {
   
   double avg_gaps = 0;
   for (int i = 0; i < n_threads; i++)
-#ifndef CPU_ONLY
-    if (use_gpu)
+    if (use_hybrid)
       avg_gaps += args[i]->hsieve->avg_gaps_per_second();
     else {
-#endif
       if (use_chinese) 
         avg_gaps += args[i]->csieve->avg_gaps_per_second();
       else 
         avg_gaps += args[i]->sieve->avg_gaps_per_second();
-#ifndef CPU_ONLY
     }
-#endif
 
   return avg_gaps;
 }
@@ -424,18 +403,14 @@ double Miner::gaps_per_second() {
   
   double gaps = 0;
   for (int i = 0; i < n_threads; i++)
-#ifndef CPU_ONLY
-    if (use_gpu)
+    if (use_hybrid)
       gaps += args[i]->hsieve->gaps_per_second();
     else {
-#endif    
       if (use_chinese) 
         gaps += args[i]->csieve->gaps_per_second();
       else 
         gaps  += args[i]->sieve->gaps_per_second();
-#ifndef CPU_ONLY
     }
-#endif
 
   return gaps;
 }
@@ -449,18 +424,14 @@ double Miner::avg_tests_per_second() {
   
   double avg_tests = 0;
   for (int i = 0; i < n_threads; i++)
-#ifndef CPU_ONLY
-    if (use_gpu)
+    if (use_hybrid)
       avg_tests += args[i]->hsieve->avg_tests_per_second();
     else {
-#endif
       if (use_chinese) 
         avg_tests += args[i]->csieve->avg_tests_per_second();
       else 
         avg_tests += args[i]->sieve->avg_tests_per_second();
-#ifndef CPU_ONLY
     }
-#endif
 
   return avg_tests;
 }
@@ -474,18 +445,14 @@ double Miner::tests_per_second() {
   
   double tests = 0;
   for (int i = 0; i < n_threads; i++)
-#ifndef CPU_ONLY
-    if (use_gpu)
+    if (use_hybrid)
       tests += args[i]->hsieve->tests_per_second();
     else {
-#endif    
       if (use_chinese) 
         tests += args[i]->csieve->tests_per_second();
        else 
         tests += args[i]->sieve->tests_per_second();
-#ifndef CPU_ONLY
     }
-#endif
 
   return tests;
 }
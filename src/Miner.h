@@ -112,10 +112,11 @@ class Miner {
     /* indicates if we should use Chinese Remainder theorem or not */
     bool use_chinese;
 
-#ifndef CPU_ONLY
-    /* indicates if we should use gpu or not */
-    bool use_gpu;
-#endif    
+    /* the ChineseSet shared by all threads */
+    ChineseSet *cset;
+
+    /* indicates if we should use the HybridSieve or not */
+    bool use_hybrid;
 
     /* synchronization mutex */
     static pthread_mutex_t mutex;       
@@ -143,10 +144,8 @@ class Miner {
         /* the ChineseSieve for this */
         ChineseSieve *csieve;
 
-#ifndef CPU_ONLY
         /* the HybridSieve for this */
         HybridSieve *hsieve;
-#endif        
 
         /* the Sieve for this */
         Sieve *sieve;
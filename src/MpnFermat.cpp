@@ -0,0 +1,141 @@
+/**
+ * Implementation of a fixed width Fermat test on the mpn layer of gmp
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "MpnFermat.h"
+
+/* the tests for each limb count (starting at MPN_FERMAT_MIN_LIMBS) */
+bool (*const MpnFermat::tests[])(const mp_limb_t *p) = {
+  fermat_test<4>,  fermat_test<5>,  fermat_test<6>,  fermat_test<7>,
+  fermat_test<8>,  fermat_test<9>,  fermat_test<10>, fermat_test<11>,
+  fermat_test<12>, fermat_test<13>, fermat_test<14>, fermat_test<15>,
+  fermat_test<16>, fermat_test<17>, fermat_test<18>, fermat_test<19>,
+  fermat_test<20>, fermat_test<21>, fermat_test<22>, fermat_test<23>,
+  fermat_test<24>
+};
+
+/**
+ * Montgomery reduction of the 2N limbs t (which are overwritten),
+ * the carry of each row is kept in the cleared low limb of t
+ */
+template <int N> 
+static inline void redc(mp_limb_t *r, 
+                        mp_limb_t *t, 
+                        const mp_limb_t *p, 
+                        mp_limb_t pinv) {
+
+  for (int i = 0; i < N; i++)
+    t[i] = mpn_addmul_1(t + i, p, N, t[i] * pinv);
+
+  if (mpn_add_n(r, t + N, t, N) || mpn_cmp(r, p, N) >= 0)
+    mpn_sub_n(r, r, p, N);
+}
+
+/* x = 2 * x mod p */
+template <int N>
+static inline void double_mod(mp_limb_t *x, const mp_limb_t *p) {
+
+  if (mpn_lshift(x, x, N, 1) || mpn_cmp(x, p, N) >= 0)
+    mpn_sub_n(x, x, p, N);
+}
+
+/**
+ * Fermat base 2 test for N limbs, the exponent p - 1 equals p 
+ * except for the lowest bit, so the bits of p are used
+ */
+template <int N>
+bool MpnFermat::fermat_test(const mp_limb_t *p) {
+
+  mp_limb_t x[N], one[N], t[2 * N], q[2];
+
+  /* -p^-1 mod 2^64 (each newton step doubles the correct bits) */
+  mp_limb_t inv = p[0];
+  for (int i = 0; i < 5; i++)
+    inv *= 2 - p[0] * inv;
+
+  const mp_limb_t pinv = -inv;
+
+  /* one = R mod p (one in Montgomery form) */
+  memset(t, 0, sizeof(mp_limb_t) * (N + 1));
+  t[N] = 1;
+  mpn_tdiv_qr(q, one, 0, t, N + 1, p, N);
+
+  /* the highest bit of the exponent */
+  memcpy(x, one, sizeof(x));
+  double_mod<N>(x, p);
+
+  for (int bit = N * GMP_LIMB_BITS - 2 - __builtin_clzll(p[N - 1]); 
+       bit >= 0; 
+       bit--) {
+
+    mpn_sqr(t, x, N);
+    redc<N>(x, t, p, pinv);
+
+    if (bit > 0 && ((p[bit / GMP_LIMB_BITS] >> (bit % GMP_LIMB_BITS)) & 1))
+      double_mod<N>(x, p);
+  }
+
+  return mpn_cmp(x, one, N) == 0;
+}
+
+/* whether p has a fixed width test */
+bool MpnFermat::supported(mpz_t mpz_p) {
+  
+  const size_t n = mpz_size(mpz_p);
+  return n >= MPN_FERMAT_MIN_LIMBS && 
+         n <= MPN_FERMAT_MAX_LIMBS && 
+         mpz_odd_p(mpz_p);
+}
+
+/** 
+ * Fermat base 2 test of p 
+ * (falls back to mpz_powm for even p and unsupported widths)
+ */
+bool MpnFermat::fermat_test(mpz_t mpz_p) {
+
+  if (supported(mpz_p))
+    return tests[mpz_size(mpz_p) - MPN_FERMAT_MIN_LIMBS](mpz_limbs_read(mpz_p));
+
+  mpz_t mpz_e, mpz_r;
+  mpz_init(mpz_e);
+  mpz_init_set_ui(mpz_r, 2);
+
+  mpz_sub_ui(mpz_e, mpz_p, 1);
+  mpz_powm(mpz_r, mpz_r, mpz_e, mpz_p);
+  
+  const bool result = (mpz_cmp_ui(mpz_r, 1) == 0);
+  mpz_clear(mpz_e);
+  mpz_clear(mpz_r);
+
+  return result;
+}
+
+const char *MpnFermat::get_name() {
+  return "mpn";
+}
+
+sieve_t MpnFermat::get_lanes() {
+  return 1;
+}
+
+/* Fermat base 2 test of n numbers */
+void MpnFermat::fermat_test(mpz_ptr *mpz_p, bool *results, sieve_t n) {
+
+  for (sieve_t i = 0; i < n; i++)
+    results[i] = fermat_test(mpz_p[i]);
+}
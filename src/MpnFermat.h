@@ -0,0 +1,68 @@
+/**
+ * Header file of a fixed width Fermat test on the mpn layer of gmp
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __MPN_FERMAT_H__
+#define __MPN_FERMAT_H__
+
+#include <gmp.h>
+#include <inttypes.h>
+#include "FermatBackend.h"
+
+/* range of the limb counts with a fixed width test (256 to 1536 bits) */
+#define MPN_FERMAT_MIN_LIMBS 4
+#define MPN_FERMAT_MAX_LIMBS 24
+
+/**
+ * Fermat base 2 test for the bit widths we mine with, one instantiation
+ * per limb count.
+ *
+ * 2^(p-1) mod p is calculated with Montgomery squarings, since the
+ * base is two the multiplications of the exponentiation are replaced by
+ * a shift and a conditional subtraction. All temporaries are on the 
+ * stack, so no memory is allocated per test.
+ */
+class MpnFermat : public FermatBackend {
+
+  public:
+
+    const char *get_name();
+
+    sieve_t get_lanes();
+
+    /* Fermat base 2 test of n numbers */
+    void fermat_test(mpz_ptr *mpz_p, bool *results, sieve_t n);
+
+    /** 
+     * Fermat base 2 test of p 
+     * (falls back to mpz_powm for even p and unsupported widths)
+     */
+    static bool fermat_test(mpz_t mpz_p);
+
+    /* whether p has a fixed width test */
+    static bool supported(mpz_t mpz_p);
+
+  private:
+
+    /* the test for the given number of limbs */
+    template <int N> static bool fermat_test(const mp_limb_t *p);
+
+    /* the tests for each limb count (starting at MPN_FERMAT_MIN_LIMBS) */
+    static bool (*const tests[])(const mp_limb_t *p);
+};
+
+#endif /* __MPN_FERMAT_H__ */
@@ -131,16 +131,29 @@ sievesize( "-s", "--sieve-size",     "the prime sieve size",
 primes(    "-i", "--sieve-primes",   "number of primes for sieving",                  true),
 shift(     "-f", "--shift",          "the adder shift",                               true),
 cset(      "-r", "--crt",            "use the given Chinese Remainder Theorem file",  true),
-fermat_threads("-d", "--fermat-threads", "number of fermat threads wen using the crt",    true),
+fermat_threads("-d", "--fermat-threads", "number of fermat threads wen using the crt or the hybrid sieve", true),
+bucket_sieve(NULL, "--bucket-sieve", "sieve the large crt primes with buckets",       false),
+batch_sieve(NULL, "--batch-sieve",   "sieve 64 crt gaps at once",                     false),
+sieve_cutoff(NULL, "--sieve-cutoff", "drop crt gaps x times less likely than the median", true),
+deep_primes(NULL, "--deep-primes",   "additional primes for promising crt gaps",      true),
+validate_avg(NULL, "--validate-avg", "verify the candidate estimates by random sampling", false),
+queue_memory(NULL, "--queue-memory", "memory budget of the crt gap queue in MB",     true),
+queue_evict(NULL, "--queue-evict",   "drop the worst gaps if the queue is full (instead of waiting)", false),
+test_order(NULL, "--test-order",     "order of the fermat tests within a crt gap: ascending (default), middle or learned", true),
+bench_order(NULL, "--bench-order",   "compare the crt test orders on the given number of gaps (needs --crt)", true),
+fermat_backend(NULL, "--fermat-backend", "force the Fermat test: gmp, mpn or simd (default: the fastest of gmp and simd at startup)", true),
 #ifndef CPU_ONLY
 benchmark( "-b", "--benchmark",      "run a gpu benchmark",                           false),
 use_gpu(   "-g", "--use-gpu",        "use the gpu for Fermat testing",                false),
 gpu_dev(   "-d", "--gpu-dev",        "the gpu device id",                             true),
-work_items("-w", "--work-items",     "gpu work items (default 2048)",                 true),
-queue_size("-z", "--queue-size",     "the gpu waiting queue size (memory intensive)", true),
 platform(  "-a", "--platform",       "opencl platform (amd or nvidia)",               true),
-n_tests(   "-n", "--num-gpu-tests",  "the number of test per gap per gpu run",        true),
+#else
+hybrid_sieve(NULL, "--hybrid-sieve", "use the gpu pipeline with the Fermat tests on cpu threads", false),
 #endif
+work_items("-w", "--work-items",     "work items of 256 Fermat tests per run",        true),
+queue_size("-z", "--queue-size",     "the sieve waiting queue size (memory intensive)", true),
+n_tests(   "-n", "--num-gpu-tests",  "the number of test per gap per Fermat run",     true),
+gcd_filter(NULL, "--gcd-filter",     "remove candidates with a factor in the next n primes above the sieve primes (cpu hybrid sieve)", true),
 calc_ctr(  NULL, "--calc-ctr",       "calculate a chinese remainder theorem file",    false),
 ctr_strength(NULL, "--ctr-strength", "more = longer time and mybe better result",     true),
 ctr_primes(NULL, "--ctr-primes",     "the number of to use primes in the ctr file",   true),
@@ -212,6 +225,36 @@ license(   "-v", "--license",        "show license of this program",
   if (fermat_threads.active)
     fermat_threads.arg = get_arg(fermat_threads.short_opt,  fermat_threads.long_opt);
 
+  bucket_sieve.active = has_arg(bucket_sieve.short_opt, bucket_sieve.long_opt);
+  batch_sieve.active  = has_arg(batch_sieve.short_opt,  batch_sieve.long_opt);
+
+  sieve_cutoff.active = has_arg(sieve_cutoff.short_opt, sieve_cutoff.long_opt);
+  if (sieve_cutoff.active)
+    sieve_cutoff.arg = get_arg(sieve_cutoff.short_opt, sieve_cutoff.long_opt);
+
+  deep_primes.active = has_arg(deep_primes.short_opt, deep_primes.long_opt);
+  if (deep_primes.active)
+    deep_primes.arg = get_arg(deep_primes.short_opt, deep_primes.long_opt);
+
+  validate_avg.active = has_arg(validate_avg.short_opt, validate_avg.long_opt);
+
+  queue_memory.active = has_arg(queue_memory.short_opt, queue_memory.long_opt);
+  if (queue_memory.active)
+    queue_memory.arg = get_arg(queue_memory.short_opt, queue_memory.long_opt);
+
+  queue_evict.active = has_arg(queue_evict.short_opt, queue_evict.long_opt);
+
+  test_order.active = has_arg(test_order.short_opt, test_order.long_opt);
+  if (test_order.active)
+    test_order.arg = get_arg(test_order.short_opt, test_order.long_opt);
+
+  bench_order.active = has_arg(bench_order.short_opt, bench_order.long_opt);
+  if (bench_order.active)
+    bench_order.arg = get_arg(bench_order.short_opt, bench_order.long_opt);
+
+  fermat_backend.active = has_arg(fermat_backend.short_opt, fermat_backend.long_opt);
+  if (fermat_backend.active)
+    fermat_backend.arg = get_arg(fermat_backend.short_opt, fermat_backend.long_opt);
 
 #ifndef CPU_ONLY
   benchmark.active = has_arg(benchmark.short_opt,  benchmark.long_opt);
@@ -221,6 +264,13 @@ license(   "-v", "--license",        "show license of this program",
   gpu_dev.active = has_arg(gpu_dev.short_opt,  gpu_dev.long_opt);
   if (gpu_dev.active)
     gpu_dev.arg = get_arg(gpu_dev.short_opt,  gpu_dev.long_opt);
+
+  platform.active = has_arg(platform.short_opt,  platform.long_opt);
+  if (platform.active)
+    platform.arg = get_arg(platform.short_opt,  platform.long_opt);
+#else
+  hybrid_sieve.active = has_arg(hybrid_sieve.short_opt, hybrid_sieve.long_opt);
+#endif    
                                           
   work_items.active = has_arg(work_items.short_opt,  work_items.long_opt);
   if (work_items.active)
@@ -230,14 +280,13 @@ license(   "-v", "--license",        "show license of this program",
   if (queue_size.active)
     queue_size.arg = get_arg(queue_size.short_opt,  queue_size.long_opt);
 
-  platform.active = has_arg(platform.short_opt,  platform.long_opt);
-  if (platform.active)
-    platform.arg = get_arg(platform.short_opt,  platform.long_opt);
-
   n_tests.active = has_arg(n_tests.short_opt,  n_tests.long_opt);
   if (n_tests.active)
     n_tests.arg = get_arg(n_tests.short_opt,  n_tests.long_opt);
-#endif    
+
+  gcd_filter.active = has_arg(gcd_filter.short_opt, gcd_filter.long_opt);
+  if (gcd_filter.active)
+    gcd_filter.arg = get_arg(gcd_filter.short_opt, gcd_filter.long_opt);
 
   calc_ctr.active = has_arg(calc_ctr.short_opt, calc_ctr.long_opt);
 
@@ -352,6 +401,36 @@ string Opts::get_help()  {
   ss << "  " << fermat_threads.short_opt  << "  " << left << setw(18);
   ss << fermat_threads.long_opt << "  " << fermat_threads.description << "\n\n";
 
+  ss << "      " << left << setw(18);
+  ss << bucket_sieve.long_opt << "  " << bucket_sieve.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << batch_sieve.long_opt << "  " << batch_sieve.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << sieve_cutoff.long_opt << "  " << sieve_cutoff.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << deep_primes.long_opt << "  " << deep_primes.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << validate_avg.long_opt << "  " << validate_avg.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << queue_memory.long_opt << "  " << queue_memory.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << queue_evict.long_opt << "  " << queue_evict.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << test_order.long_opt << "  " << test_order.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << bench_order.long_opt << "  " << bench_order.description << "\n\n";
+
+  ss << "      " << left << setw(18);
+  ss << fermat_backend.long_opt << "  " << fermat_backend.description << "\n\n";
+
 #ifndef CPU_ONLY
   ss << "  " << benchmark.short_opt  << "  " << left << setw(18);
   ss << benchmark.long_opt << "  " << benchmark.description << "\n\n";
@@ -362,18 +441,24 @@ string Opts::get_help()  {
   ss << "  " << gpu_dev.short_opt  << "  " << left << setw(18);
   ss << gpu_dev.long_opt << "  " << gpu_dev.description << "\n\n";
 
+  ss << "  " << platform.short_opt  << "  " << left << setw(18);
+  ss << platform.long_opt << "  " << platform.description << "\n\n";
+#else
+  ss << "      " << left << setw(18);
+  ss << hybrid_sieve.long_opt << "  " << hybrid_sieve.description << "\n\n";
+#endif  
+
   ss << "  " << work_items.short_opt  << "  " << left << setw(18);
   ss << work_items.long_opt << "  " << work_items.description << "\n\n";
 
   ss << "  " << queue_size.short_opt  << "  " << left << setw(18);
   ss << queue_size.long_opt << "  " << queue_size.description << "\n\n";
 
-  ss << "  " << platform.short_opt  << "  " << left << setw(18);
-  ss << platform.long_opt << "  " << platform.description << "\n\n";
-
   ss << "  " << n_tests.short_opt  << "  " << left << setw(18);
   ss << n_tests.long_opt << "  " << n_tests.description << "\n\n";
-#endif  
+
+  ss << "      " << left << setw(18);
+  ss << gcd_filter.long_opt << "  " << gcd_filter.description << "\n\n";
 
   ss << "      " << left << setw(18);
   ss << calc_ctr.long_opt << "  " << calc_ctr.description << "\n\n";
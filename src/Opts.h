@@ -86,15 +86,28 @@ class Opts {
     SingleOpt shift;
     SingleOpt cset;
     SingleOpt fermat_threads;
+    SingleOpt bucket_sieve;
+    SingleOpt batch_sieve;
+    SingleOpt sieve_cutoff;
+    SingleOpt deep_primes;
+    SingleOpt validate_avg;
+    SingleOpt queue_memory;
+    SingleOpt queue_evict;
+    SingleOpt test_order;
+    SingleOpt bench_order;
+    SingleOpt fermat_backend;
 #ifndef CPU_ONLY
     SingleOpt benchmark;
     SingleOpt use_gpu;
     SingleOpt gpu_dev;
+    SingleOpt platform;
+#else
+    SingleOpt hybrid_sieve;
+#endif    
     SingleOpt work_items;
     SingleOpt queue_size;
-    SingleOpt platform;
     SingleOpt n_tests;
-#endif    
+    SingleOpt gcd_filter;
     SingleOpt calc_ctr;
     SingleOpt ctr_strength;
     SingleOpt ctr_primes;
@@ -167,6 +180,32 @@ class Opts {
 
     bool has_fermat_threads()   { return fermat_threads.active; }
     string get_fermat_threads() { return fermat_threads.arg;    }
+
+    bool has_bucket_sieve()     { return bucket_sieve.active;   }
+
+    bool has_batch_sieve()      { return batch_sieve.active;    }
+
+    bool has_sieve_cutoff()     { return sieve_cutoff.active;   }
+    string get_sieve_cutoff()   { return sieve_cutoff.arg;      }
+
+    bool has_deep_primes()      { return deep_primes.active;    }
+    string get_deep_primes()    { return deep_primes.arg;       }
+
+    bool has_validate_avg()     { return validate_avg.active;   }
+
+    bool has_queue_memory()     { return queue_memory.active;   }
+    string get_queue_memory()   { return queue_memory.arg;      }
+
+    bool has_queue_evict()      { return queue_evict.active;    }
+
+    bool has_test_order()       { return test_order.active;     }
+    string get_test_order()     { return test_order.arg;        }
+
+    bool has_bench_order()      { return bench_order.active;    }
+    string get_bench_order()    { return bench_order.arg;       }
+
+    bool has_fermat_backend()   { return fermat_backend.active; }
+    string get_fermat_backend() { return fermat_backend.arg;    }
                                                         
 #ifndef CPU_ONLY                                                        
     bool has_benchmark()        { return benchmark.active;      }
@@ -176,18 +215,23 @@ class Opts {
     bool has_gpu_dev()          { return gpu_dev.active;        }
     string get_gpu_dev()        { return gpu_dev.arg;           }
                                                                 
+    bool has_platform()         { return platform.active;       }
+    string get_platform()       { return platform.arg;          }
+#else
+    bool has_hybrid_sieve()     { return hybrid_sieve.active;   }
+#endif    
+                                                                
     bool has_work_items()       { return work_items.active;     }
     string get_work_items()     { return work_items.arg;        }
                                                                 
     bool has_queue_size()       { return queue_size.active;     }
     string get_queue_size()     { return queue_size.arg;        }
                                                                 
-    bool has_platform()         { return platform.active;       }
-    string get_platform()       { return platform.arg;          }
-                                                                
     bool has_n_tests()          { return n_tests.active;        }
     string get_n_tests()        { return n_tests.arg;           }
-#endif    
+
+    bool has_gcd_filter()       { return gcd_filter.active;     }
+    string get_gcd_filter()     { return gcd_filter.arg;        }
 
     bool has_calc_ctr()         { return calc_ctr.active;       }
     string get_calc_ctr()       { return calc_ctr.arg;          }
@@ -0,0 +1,321 @@
+/**
+ * Implementation of a Fermat test of several numbers at once in the
+ * lanes of AVX-512 IFMA vectors
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+/* gcc 12 warns about the _mm512_undefined_epi32() of its own headers */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#include "SimdFermat.h"
+#include "MpnFermat.h"
+
+#define SIMD_FERMAT_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+/* lower 52 bits of a limb */
+#define SIMD_FERMAT_MASK ((((uint64_t) 1) << SIMD_FERMAT_LIMB_BITS) - 1)
+
+/**
+ * Montgomery multiplication of the lanes of a and b (limbs below 2^52), 
+ * the result r is not normalized (limbs up to 2^60)
+ */
+template <int L> SIMD_FERMAT_TARGET
+static inline void mont_mul(__m512i *r, 
+                            const __m512i *a, 
+                            const __m512i *b, 
+                            const __m512i *p, 
+                            const __m512i pinv) {
+
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i acc[L + 1];
+
+  for (int j = 0; j <= L; j++)
+    acc[j] = zero;
+
+  for (int i = 0; i < L; i++) {
+    for (int j = 0; j < L; j++) {
+      acc[j]     = _mm512_madd52lo_epu64(acc[j],     a[i], b[j]);
+      acc[j + 1] = _mm512_madd52hi_epu64(acc[j + 1], a[i], b[j]);
+    }
+
+    /* m = acc[0] * -p^-1 mod 2^52, clears the low 52 bits of acc[0] */
+    const __m512i m = _mm512_madd52lo_epu64(zero, acc[0], pinv);
+
+    for (int j = 0; j < L; j++) {
+      acc[j]     = _mm512_madd52lo_epu64(acc[j],     m, p[j]);
+      acc[j + 1] = _mm512_madd52hi_epu64(acc[j + 1], m, p[j]);
+    }
+
+    /* divide by 2^52 */
+    acc[1] = _mm512_add_epi64(acc[1], _mm512_srli_epi64(acc[0], SIMD_FERMAT_LIMB_BITS));
+    for (int j = 0; j < L; j++)
+      acc[j] = acc[j + 1];
+
+    acc[L] = zero;
+  }
+
+  for (int j = 0; j < L; j++)
+    r[j] = acc[j];
+}
+
+/**
+ * Montgomery squaring of the lanes of a (limbs below 2^52), the cross
+ * products are only calculated once and doubled, the result r is not
+ * normalized (limbs up to 2^60)
+ */
+template <int L> SIMD_FERMAT_TARGET
+static inline void mont_sqr(__m512i *r, 
+                            const __m512i *a, 
+                            const __m512i *p, 
+                            const __m512i pinv) {
+
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i t[2 * L + 1];
+
+  for (int k = 0; k <= 2 * L; k++)
+    t[k] = zero;
+
+  for (int i = 0; i < L; i++) {
+    for (int j = i + 1; j < L; j++) {
+      t[i + j]     = _mm512_madd52lo_epu64(t[i + j],     a[i], a[j]);
+      t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], a[i], a[j]);
+    }
+  }
+
+  for (int k = 0; k < 2 * L; k++)
+    t[k] = _mm512_slli_epi64(t[k], 1);
+
+  for (int i = 0; i < L; i++) {
+    t[2 * i]     = _mm512_madd52lo_epu64(t[2 * i],     a[i], a[i]);
+    t[2 * i + 1] = _mm512_madd52hi_epu64(t[2 * i + 1], a[i], a[i]);
+  }
+
+  /* reduce one limb per round */
+  for (int i = 0; i < L; i++) {
+    const __m512i m = _mm512_madd52lo_epu64(zero, t[i], pinv);
+
+    for (int j = 0; j < L; j++) {
+      t[i + j]     = _mm512_madd52lo_epu64(t[i + j],     m, p[j]);
+      t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], m, p[j]);
+    }
+
+    t[i + 1] = _mm512_add_epi64(t[i + 1], _mm512_srli_epi64(t[i], SIMD_FERMAT_LIMB_BITS));
+  }
+
+  for (int j = 0; j < L; j++)
+    r[j] = t[L + j];
+}
+
+/* propagates the carries of x, so all limbs are below 2^52 */
+template <int L> SIMD_FERMAT_TARGET
+static inline void normalize(__m512i *x) {
+
+  const __m512i mask = _mm512_set1_epi64(SIMD_FERMAT_MASK);
+  for (int j = 0; j < L - 1; j++) {
+    x[j + 1] = _mm512_add_epi64(x[j + 1], _mm512_srli_epi64(x[j], SIMD_FERMAT_LIMB_BITS));
+    x[j]     = _mm512_and_si512(x[j], mask);
+  }
+}
+
+/**
+ * 2^(p-1) mod p for eight numbers with L limbs, the exponent bits
+ * are scanned from top to zero
+ *
+ * x stays below 4p: squaring x < 4p gives (16p^2 + pR) / R < 2p 
+ * (for R = 2^(52L) > 16p), and doubling gives less than 4p again
+ */
+template <int L> SIMD_FERMAT_TARGET
+static void fermat_kernel(const uint64_t *p_limbs,
+                          const uint64_t *pinv_lanes,
+                          const uint64_t *one,
+                          const uint8_t *bits,
+                          sieve_t top,
+                          uint64_t *result) {
+
+  __m512i p[L], x[L];
+  const __m512i pinv = _mm512_loadu_si512(pinv_lanes);
+
+  for (int j = 0; j < L; j++) {
+    p[j] = _mm512_loadu_si512(p_limbs + j * SIMD_FERMAT_LANES);
+    x[j] = _mm512_loadu_si512(one + j * SIMD_FERMAT_LANES);
+  }
+
+  for (sieve_t bit = top + 1; bit-- > 0;) {
+    mont_sqr<L>(x, x, p, pinv);
+
+    const __mmask8 set = bits[bit];
+    for (int j = 0; j < L; j++)
+      x[j] = _mm512_mask_slli_epi64(x[j], set, x[j], 1);
+
+    normalize<L>(x);
+  }
+
+  /* out of Montgomery form (the result is at most p) */
+  __m512i unit[L];
+  unit[0] = _mm512_set1_epi64(1);
+  for (int j = 1; j < L; j++)
+    unit[j] = _mm512_setzero_si512();
+
+  mont_mul<L>(x, x, unit, p, pinv);
+  normalize<L>(x);
+
+  for (int j = 0; j < L; j++)
+    _mm512_storeu_si512(result + j * SIMD_FERMAT_LANES, x[j]);
+}
+
+/* the tests for each limb count (starting at SIMD_FERMAT_MIN_LIMBS) */
+void (*const SimdFermat::kernels[])(const uint64_t *p,
+                                    const uint64_t *pinv,
+                                    const uint64_t *one,
+                                    const uint8_t *bits,
+                                    sieve_t top,
+                                    uint64_t *result) = {
+  fermat_kernel<5>,  fermat_kernel<6>,  fermat_kernel<7>,  fermat_kernel<8>,
+  fermat_kernel<9>,  fermat_kernel<10>, fermat_kernel<11>, fermat_kernel<12>,
+  fermat_kernel<13>, fermat_kernel<14>, fermat_kernel<15>, fermat_kernel<16>,
+  fermat_kernel<17>, fermat_kernel<18>, fermat_kernel<19>, fermat_kernel<20>,
+  fermat_kernel<21>, fermat_kernel<22>, fermat_kernel<23>, fermat_kernel<24>,
+  fermat_kernel<25>, fermat_kernel<26>
+};
+
+SimdFermat::SimdFermat() {
+
+  log_str("creating SimdFermat", LOG_D);
+  mpz_init(mpz_tmp);
+}
+
+SimdFermat::~SimdFermat() {
+  mpz_clear(mpz_tmp);
+}
+
+const char *SimdFermat::get_name() {
+  return "simd";
+}
+
+sieve_t SimdFermat::get_lanes() {
+  return SIMD_FERMAT_LANES;
+}
+
+/* whether the cpu supports the simd test */
+bool SimdFermat::supported() {
+
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f") && 
+         __builtin_cpu_supports("avx512ifma");
+}
+
+/* splits the given number into the limbs of the given lane */
+void SimdFermat::set_lane(uint64_t *dst, 
+                          sieve_t lane, 
+                          mpz_t mpz_src, 
+                          sieve_t n_limbs) {
+
+  const mp_limb_t *src = mpz_limbs_read(mpz_src);
+  const sieve_t size   = mpz_size(mpz_src);
+
+  for (sieve_t j = 0; j < n_limbs; j++) {
+    const sieve_t bit   = j * SIMD_FERMAT_LIMB_BITS;
+    const sieve_t index = bit / 64;
+    const sieve_t shift = bit % 64;
+
+    uint64_t limb = (index < size) ? src[index] >> shift : 0;
+    if (shift > 64 - SIMD_FERMAT_LIMB_BITS && index + 1 < size)
+      limb |= src[index + 1] << (64 - shift);
+
+    dst[j * SIMD_FERMAT_LANES + lane] = limb & SIMD_FERMAT_MASK;
+  }
+}
+
+/* whether all numbers are odd (Montgomery needs an odd modulus) */
+static bool all_odd(mpz_ptr *mpz_p, sieve_t n) {
+
+  for (sieve_t i = 0; i < n; i++)
+    if (mpz_even_p(mpz_p[i]))
+      return false;
+
+  return true;
+}
+
+/**
+ * Fermat base 2 test of n numbers (up to SIMD_FERMAT_LANES),
+ * numbers to wide for the simd test are tested by MpnFermat 
+ */
+void SimdFermat::fermat_test(mpz_ptr *mpz_p, bool *results, sieve_t n) {
+
+  if (n == 0)
+    return;
+
+  /* the widest number decides the limb count (four spare bits) */
+  sieve_t top = 0;
+  for (sieve_t i = 0; i < n; i++)
+    if (mpz_sizeinbase(mpz_p[i], 2) - 1 > top)
+      top = mpz_sizeinbase(mpz_p[i], 2) - 1;
+
+  const sieve_t n_limbs = (top + 1 + 4 + SIMD_FERMAT_LIMB_BITS - 1) / 
+                          SIMD_FERMAT_LIMB_BITS;
+
+  if (n_limbs > SIMD_FERMAT_MAX_LIMBS || !all_odd(mpz_p, n)) {
+    for (sieve_t i = 0; i < n; i++)
+      results[i] = MpnFermat::fermat_test(mpz_p[i]);
+
+    return;
+  }
+
+  const sieve_t limbs = (n_limbs < SIMD_FERMAT_MIN_LIMBS) ? 
+                        SIMD_FERMAT_MIN_LIMBS : n_limbs;
+
+  memset(bits, 0, top + 1);
+  for (sieve_t i = 0; i < SIMD_FERMAT_LANES; i++) {
+
+    /* unused lanes repeat the first number */
+    mpz_ptr mpz_lane = mpz_p[(i < n) ? i : 0];
+    set_lane(p, i, mpz_lane, limbs);
+
+    /* -p^-1 mod 2^52 (each newton step doubles the correct bits) */
+    const uint64_t p0 = mpz_getlimbn(mpz_lane, 0);
+    uint64_t inv = p0;
+    for (sieve_t j = 0; j < 5; j++)
+      inv *= 2 - p0 * inv;
+
+    pinv[i] = (0 - inv) & SIMD_FERMAT_MASK;
+
+    /* one in Montgomery form: R mod p */
+    mpz_set_ui(mpz_tmp, 0);
+    mpz_setbit(mpz_tmp, limbs * SIMD_FERMAT_LIMB_BITS);
+    mpz_tdiv_r(mpz_tmp, mpz_tmp, mpz_lane);
+    set_lane(one, i, mpz_tmp, limbs);
+
+    /* the exponent p - 1 (the lowest bit is cleared) */
+    const mp_limb_t *limbs_lane = mpz_limbs_read(mpz_lane);
+    const sieve_t top_lane      = mpz_sizeinbase(mpz_lane, 2) - 1;
+    for (sieve_t bit = 1; bit <= top_lane; bit++)
+      bits[bit] |= (uint8_t) (((limbs_lane[bit / 64] >> (bit % 64)) & 1) << i);
+  }
+
+  kernels[limbs - SIMD_FERMAT_MIN_LIMBS](p, pinv, one, bits, top, result);
+
+  for (sieve_t i = 0; i < n; i++) {
+    bool is_one = (result[i] == 1);
+    for (sieve_t j = 1; j < limbs && is_one; j++)
+      is_one = (result[j * SIMD_FERMAT_LANES + i] == 0);
+
+    results[i] = is_one;
+  }
+}
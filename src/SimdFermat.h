@@ -0,0 +1,100 @@
+/**
+ * Header file of a Fermat test of several numbers at once in the
+ * lanes of AVX-512 IFMA vectors
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SIMD_FERMAT_H__
+#define __SIMD_FERMAT_H__
+
+#include <gmp.h>
+#include <inttypes.h>
+#include "utils.h"
+#include "FermatBackend.h"
+
+/* numbers tested at once (64 bit lanes of a 512 bit vector) */
+#define SIMD_FERMAT_LANES 8
+
+/* bits per limb (the multiply width of IFMA) */
+#define SIMD_FERMAT_LIMB_BITS 52
+
+/* range of the limb counts (up to 1348 bits) */
+#define SIMD_FERMAT_MIN_LIMBS 5
+#define SIMD_FERMAT_MAX_LIMBS 26
+
+/**
+ * Fermat base 2 test of up to eight numbers in lockstep, a CPU port 
+ * of the batched GPU test: each number is split into 52 bit limbs, 
+ * and limb j of all numbers is stored in one vector, so one IFMA 
+ * instruction multiplies eight limbs.
+ *
+ * The Montgomery squarings are not fully reduced, the numbers stay 
+ * below 4p (which needs four spare bits), so the lanes never compare
+ * or branch. The doublings of the base 2 exponentiation are a masked 
+ * shift in the lanes where the exponent bit is set.
+ */
+class SimdFermat : public FermatBackend {
+
+  public:
+
+    SimdFermat();
+
+    ~SimdFermat();
+
+    const char *get_name();
+
+    sieve_t get_lanes();
+
+    /* whether the cpu supports the simd test */
+    static bool supported();
+
+    /**
+     * Fermat base 2 test of n numbers (up to SIMD_FERMAT_LANES),
+     * numbers to wide for the simd test are tested by MpnFermat 
+     */
+    void fermat_test(mpz_ptr *mpz_p, bool *results, sieve_t n);
+
+  private:
+
+    /* the numbers, and one in Montgomery form (limb j of lane i at j * 8 + i) */
+    uint64_t p[SIMD_FERMAT_MAX_LIMBS * SIMD_FERMAT_LANES];
+    uint64_t one[SIMD_FERMAT_MAX_LIMBS * SIMD_FERMAT_LANES];
+
+    /* -p^-1 mod 2^52 of each lane */
+    uint64_t pinv[SIMD_FERMAT_LANES];
+
+    /* the lanes with a set exponent bit, for each bit */
+    uint8_t bits[SIMD_FERMAT_MAX_LIMBS * SIMD_FERMAT_LIMB_BITS];
+
+    /* 2^(p-1) mod p of each lane */
+    uint64_t result[SIMD_FERMAT_MAX_LIMBS * SIMD_FERMAT_LANES];
+
+    /* tmp for the setup of a lane */
+    mpz_t mpz_tmp;
+
+    /* splits the given number into the limbs of the given lane */
+    void set_lane(uint64_t *dst, sieve_t lane, mpz_t mpz_src, sieve_t n_limbs);
+
+    /* the tests for each limb count (starting at SIMD_FERMAT_MIN_LIMBS) */
+    static void (*const kernels[])(const uint64_t *p,
+                                   const uint64_t *pinv,
+                                   const uint64_t *one,
+                                   const uint8_t *bits,
+                                   sieve_t top,
+                                   uint64_t *result);
+};
+
+#endif /* __SIMD_FERMAT_H__ */
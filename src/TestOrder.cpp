@@ -0,0 +1,172 @@
+/**
+ * Implementation of the order in which the candidates of a crt gap
+ * are tested
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include "TestOrder.h"
+
+using namespace std;
+
+/* the names of all orders */
+const char *TestOrder::names[] = { "ascending", "middle", "learned" };
+const sieve_t TestOrder::n_orders = 3;
+
+/* compares odd offsets by there prime probability (most likely first) */
+class CompareProbability {
+
+  public:
+
+    const double *probability;
+
+    CompareProbability(const double *probability) : probability(probability) { }
+
+    bool operator()(uint32_t a, uint32_t b) const {
+      if (probability[a] != probability[b])
+        return probability[a] > probability[b];
+
+      return a < b;
+    }
+};
+
+/* creates the order with the given name for gaps of the given size */
+TestOrder::TestOrder(const char *name, sieve_t sievesize) {
+
+  this->order = n_orders;
+  for (sieve_t i = 0; i < n_orders; i++)
+    if (!strcmp(name, names[i]))
+      this->order = i;
+
+  if (this->order == n_orders) {
+    cout << "unknown test order: " << name << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  log_str("creating TestOrder " + string(name), LOG_D);
+  this->n_offsets = bound(sievesize, sizeof(sieve_t) * 8) / 2;
+  this->n_learned = 0;
+  this->rank      = (uint32_t *) malloc(sizeof(uint32_t) * n_offsets);
+  this->tests     = (uint32_t *) calloc(n_offsets, sizeof(uint32_t));
+  this->primes    = (uint32_t *) calloc(n_offsets, sizeof(uint32_t));
+  pthread_mutex_init(&update_mutex, NULL);
+
+  const sieve_t middle = sievesize / 4;
+  for (sieve_t i = 0; i < n_offsets; i++) {
+    if (order == TEST_ORDER_MIDDLE)
+      rank[i] = 2 * ((i < middle) ? middle - i : i - middle) + (i < middle);
+    else
+      rank[i] = i;
+  }
+}
+
+TestOrder::~TestOrder() {
+  free(rank);
+  free(tests);
+  free(primes);
+  pthread_mutex_destroy(&update_mutex);
+}
+
+/**
+ * sorts the given candidates into test order 
+ * (keys is a scratch buffer for at least n_candidates)
+ *
+ * the ranks are read once into the sort keys, since the learned
+ * ranks can be updated by an other thread in the meantime
+ */
+void TestOrder::sort(uint32_t *candidates, uint32_t n_candidates, uint64_t *keys) {
+
+  if (order == TEST_ORDER_ASCENDING)
+    return;
+
+  for (uint32_t i = 0; i < n_candidates; i++)
+    keys[i] = (((uint64_t) rank[candidates[i] >> 1]) << 32) | candidates[i];
+
+  std::sort(keys, keys + n_candidates);
+
+  for (uint32_t i = 0; i < n_candidates; i++)
+    candidates[i] = (uint32_t) keys[i];
+}
+
+/**
+ * learns from the tested candidates of a gap 
+ * (the last one is a prime if found_prime is true)
+ */
+void TestOrder::learn(const uint32_t *candidates, 
+                      uint32_t n_tested, 
+                      bool found_prime) {
+
+  if (order != TEST_ORDER_LEARNED)
+    return;
+
+  for (uint32_t i = 0; i < n_tested; i++)
+    __sync_fetch_and_add(&tests[candidates[i] >> 1], 1);
+
+  if (found_prime && n_tested > 0)
+    __sync_fetch_and_add(&primes[candidates[n_tested - 1] >> 1], 1);
+
+  if (__sync_add_and_fetch(&n_learned, 1) % TEST_ORDER_LEARN_GAPS == 0)
+    update();
+}
+
+/**
+ * recalculates the learned order, the prime probability of each offset
+ * is estimated from its tests and found primes, plus TEST_ORDER_PRIOR 
+ * tests with the average probability (so rarely tested offsets stay 
+ * close to the average)
+ */
+void TestOrder::update() {
+
+  if (order != TEST_ORDER_LEARNED || pthread_mutex_trylock(&update_mutex))
+    return;
+
+  uint64_t sum_tests = 0, sum_primes = 0;
+  for (sieve_t i = 0; i < n_offsets; i++) {
+    sum_tests  += tests[i];
+    sum_primes += primes[i];
+  }
+
+  if (sum_tests > 0) {
+    const double avg = ((double) sum_primes) / sum_tests;
+    double   *probability = (double *)   malloc(sizeof(double) * n_offsets);
+    uint32_t *offsets     = (uint32_t *) malloc(sizeof(uint32_t) * n_offsets);
+
+    for (sieve_t i = 0; i < n_offsets; i++) {
+      probability[i] = (primes[i] + avg * TEST_ORDER_PRIOR) / 
+                       (tests[i] + TEST_ORDER_PRIOR);
+      offsets[i] = i;
+    }
+
+    std::sort(offsets, offsets + n_offsets, CompareProbability(probability));
+    for (sieve_t i = 0; i < n_offsets; i++)
+      rank[offsets[i]] = i;
+
+    free(probability);
+    free(offsets);
+    log_str("updated the learned test order from " + itoa(sum_tests) + 
+            " tests", LOG_D);
+  }
+
+  pthread_mutex_unlock(&update_mutex);
+}
+
+/* returns the name of this */
+const char *TestOrder::get_name() {
+  return names[order];
+}
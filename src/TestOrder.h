@@ -0,0 +1,101 @@
+/**
+ * Header file for the order in which the candidates of a crt gap
+ * are tested
+ * 
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __TEST_ORDER_H__
+#define __TEST_ORDER_H__
+
+#include <pthread.h>
+#include <inttypes.h>
+#include "utils.h"
+
+/* the test orders */
+#define TEST_ORDER_ASCENDING 0
+#define TEST_ORDER_MIDDLE    1
+#define TEST_ORDER_LEARNED   2
+
+/* number of gaps between two updates of the learned order */
+#define TEST_ORDER_LEARN_GAPS (1 << 12)
+
+/* weight (in tests) of the average prime probability for each offset */
+#define TEST_ORDER_PRIOR 64
+
+/**
+ * The candidates of a gap are tested until the first prime, so testing
+ * the most likely primes first saves tests on invalid gaps.
+ *
+ * Each order is a rank for each odd offset of the gaps:
+ *   ascending: the offset (no sorting needed)
+ *   middle:    the distance to the middle of the gap
+ *   learned:   the measured prime probability of the offset 
+ *              (most likely first), learned from the tested gaps 
+ */
+class TestOrder {
+
+  public:
+
+    /* creates the order with the given name for gaps of the given size */
+    TestOrder(const char *name, sieve_t sievesize);
+
+    ~TestOrder();
+
+    /**
+     * sorts the given candidates into test order 
+     * (keys is a scratch buffer for at least n_candidates)
+     */
+    void sort(uint32_t *candidates, uint32_t n_candidates, uint64_t *keys);
+
+    /**
+     * learns from the tested candidates of a gap 
+     * (the last one is a prime if found_prime is true)
+     */
+    void learn(const uint32_t *candidates, uint32_t n_tested, bool found_prime);
+
+    /* recalculates the learned order */
+    void update();
+
+    /* returns the name of this */
+    const char *get_name();
+
+    /* returns the names of all orders */
+    static const char *names[];
+    static const sieve_t n_orders;
+
+  private:
+
+    /* the order of this */
+    sieve_t order;
+
+    /* number of odd offsets */
+    sieve_t n_offsets;
+
+    /* the rank of each odd offset (offset / 2) */
+    uint32_t *rank;
+
+    /* number of tests and found primes for each odd offset */
+    uint32_t *tests;
+    uint32_t *primes;
+
+    /* number of learned gaps */
+    volatile uint64_t n_learned;
+
+    /* ensures only one thread updates the order */
+    pthread_mutex_t update_mutex;
+};
+
+#endif /* __TEST_ORDER_H__ */
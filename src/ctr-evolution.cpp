@@ -478,43 +478,52 @@ void start_chinese_evolution(sieve_t n_primes,
   Individual iv = best_evolution(&args);
   Chinese *c = (Chinese *) iv.iv;
 
-  sieve_t avg_count = 0;
   sieve_t max_count = c->sievesize - (fitness_chinese(&iv, NULL) * c->sievesize) / 10000000000;
 
-  /** calculate the average candidates per sieve */
-  for (ssieve_t i = 0; i < 10000; i++) {
+  /* the average number of composites per sieve */
+  const double avg_composite = c->sievesize - expected_candidates(first_primes, c->n_primes, c->sievesize);
 
-    cout << "running: " << 10000 - i << "    \r";
-    memset(c->sieve, 0, c->byte_size);
+  if (Opts::get_instance()->has_validate_avg()) {
+    sieve_t avg_count = 0;
 
-    for (sieve_t x = 0; x < c->n_primes; x++) {
-    
-      const sieve_t index = rand128(c->rand) % first_primes[x];
-      const sieve_t prime = first_primes[x];
+    /** calculate the average candidates per sieve */
+    for (ssieve_t i = 0; i < 10000; i++) {
+
+      cout << "running: " << 10000 - i << "    \r";
+      memset(c->sieve, 0, c->byte_size);
+
+      for (sieve_t x = 0; x < c->n_primes; x++) {
       
-      for (sieve_t p = prime - index; p < c->sievesize; p += prime)
-        set_composite(c->sieve, p);
+        const sieve_t index = rand128(c->rand) % first_primes[x];
+        const sieve_t prime = first_primes[x];
+        
+        for (sieve_t p = prime - index; p < c->sievesize; p += prime)
+          set_composite(c->sieve, p);
 
-    }
+      }
+
+      /* count the candidates */
+      sieve_t cur_count = 0;
+      for (sieve_t s = 0; s < c->word_size; s++)
+        cur_count += popcount(c->sieve[s]);
 
-    /* count the candidates */
-    sieve_t cur_count = 0;
-    for (sieve_t s = 0; s < c->word_size; s++)
-      cur_count += popcount(c->sieve[s]);
+      avg_count += cur_count;
+    }
 
-    avg_count += cur_count;
+    cout << "[II] avg: " << avg_composite;
+    cout << " sampled: " << ((double) avg_count) / 10000 << endl;
   }
 
   double max_candidates = c->sievesize - max_count;
-  double avg_candidates = c->sievesize - (((double) avg_count) / 10000);
+  double avg_candidates = c->sievesize - avg_composite;
 
   cout << "[II] max: " << max_count;
-  cout << " avg: " << avg_count / 10000 << endl;
+  cout << " avg: " << (sieve_t) avg_composite << endl;
   cout << " " << 100.0 - (max_candidates / avg_candidates) * 100;
   cout << " % more composite numbers than average" << endl;
   cout << " " << exp((1.0 - (max_candidates / avg_candidates)) * merit) << " factor speed increase" << endl;
-  cout << " " << max_count - (avg_count / 10000) << " candidates less" << endl;
-  cout << " " << c->sievesize - (avg_count / 10000) << " candidates avg" << endl;
+  cout << " " << max_count - (sieve_t) avg_composite << " candidates less" << endl;
+  cout << " " << c->sievesize - (sieve_t) avg_composite << " candidates avg" << endl;
   cout << " " << c->sievesize - max_count << " candidates min" << endl;
   cout << " " << (avg_candidates / c->sievesize) * 100 << " % prime candidates avg" << endl;
   cout << " " << (max_candidates / c->sievesize) * 100 << " % prime candidates min" << endl;
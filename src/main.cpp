@@ -36,8 +36,10 @@
 #include "utils.h"
 #include "Stratum.h"
 #include "GPUFermat.h"
+#include "CPUFermat.h"
 #include "BestChinese.h"
 #include "ctr-evolution.h"
+#include "ChineseSieve.h"
 
 using namespace std;
 
@@ -146,6 +148,9 @@ void *getwork_thread(void *arg) {
 #ifndef CPU_ONLY
   if (opts->has_use_gpu())
     shift = 64;
+#else
+  if (opts->has_hybrid_sieve())
+    shift = 64;
 #endif    
   
 
@@ -241,6 +246,23 @@ int main(int argc, char *argv[]) {
   }
 #endif
 
+  if (opts->has_bench_order()) {
+    if (!opts->has_cset()) {
+      cout << "--bench-order needs a chinese remainder theorem file (--crt)" << endl;
+      exit(EXIT_FAILURE);
+    }
+
+    uint64_t primes = (opts->has_primes() ? 
+                       atoll(opts->get_primes().c_str()) :
+                       900000);
+
+    ChineseSet cset(opts->get_cset().c_str());
+    ChineseSieve::benchmark_test_orders(primes, 
+                                        &cset, 
+                                        atoi(opts->get_bench_order().c_str()));
+    exit(EXIT_SUCCESS);
+  }
+
   if (opts->has_calc_ctr() && 
       opts->has_ctr_primes() &&
       opts->has_ctr_merit() &&
@@ -355,6 +377,26 @@ int main(int argc, char *argv[]) {
 
     GPUFermat::get_instance(dev_id, platfrom.c_str(), workItems);
   }
+#else
+  if (opts->has_hybrid_sieve()) {
+
+    sieve_size = (opts->has_sievesize() ? 
+                  atoll(opts->get_sievesize().c_str()) :
+                  12000000); 
+ 
+    primes     = (opts->has_primes() ? 
+                 atoll(opts->get_primes().c_str()) :
+                 3000000);
+
+    shift = 64;
+
+    /* the Fermat tests run on there own threads (the sieve uses one) */
+    unsigned n_fermat  = (opts->has_fermat_threads() ? atoi(opts->get_fermat_threads().c_str()) : 1);
+    unsigned workItems = (opts->has_work_items() ? atoi(opts->get_work_items().c_str()) : 512);
+    uint64_t n_filter  = (opts->has_gcd_filter() ? atoll(opts->get_gcd_filter().c_str()) : 0);
+
+    CPUFermat::get_instance(n_fermat, workItems, primes, n_filter);
+  }
 #endif
  
 
@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#include <immintrin.h>
 #include "utils.h"
 
 /**
@@ -131,3 +132,266 @@ void log_string(string str, int status) {
   pthread_mutex_unlock(&log_mutex);
 }
 #endif
+
+/* bits of all odd offsets within a sieve word */
+#define ODD_BITS 0xAAAAAAAAAAAAAAAAULL
+
+/* returns the odd prime bits of word k of a sieve, masked to [start, end) */
+static inline sieve_t candidate_bits(const sieve_t *sieve, 
+                                     sieve_t k, 
+                                     sieve_t start, 
+                                     sieve_t end) {
+
+  sieve_t bits = ~sieve[k] & ODD_BITS;
+
+  if (k == start / 64)
+    bits &= ~((sieve_t) 0) << (start % 64);
+  if (k == (end - 1) / 64 && end % 64 != 0)
+    bits &= (((sieve_t) 1) << (end % 64)) - 1;
+
+  return bits;
+}
+
+/* extracts the candidates with tzcnt / blsr */
+static uint32_t extract_candidates_scalar(const sieve_t *sieve, 
+                                          sieve_t start, 
+                                          sieve_t end, 
+                                          uint32_t add, 
+                                          uint32_t *dst) {
+
+  uint32_t n = 0;
+  for (sieve_t k = start / 64; k <= (end - 1) / 64; k++) {
+
+    sieve_t bits = candidate_bits(sieve, k, start, end);
+    const uint32_t base = add + k * 64;
+
+    while (bits) {
+      dst[n++] = base + __builtin_ctzll(bits);
+      bits &= bits - 1;
+    }
+  }
+
+  return n;
+}
+
+/* extracts the candidates with avx512 compress stores */
+__attribute__((target("avx512f,bmi2,popcnt")))
+static uint32_t extract_candidates_avx512(const sieve_t *sieve, 
+                                          sieve_t start, 
+                                          sieve_t end, 
+                                          uint32_t add, 
+                                          uint32_t *dst) {
+
+  const __m512i sixty_four = _mm512_set1_epi32(64);
+  __m512i low  = _mm512_setr_epi32( 1,  3,  5,  7,  9, 11, 13, 15,
+                                   17, 19, 21, 23, 25, 27, 29, 31);
+  __m512i high = _mm512_add_epi32(low, _mm512_set1_epi32(32));
+
+  const __m512i base = _mm512_set1_epi32(add + (start / 64) * 64);
+  low  = _mm512_add_epi32(low, base);
+  high = _mm512_add_epi32(high, base);
+
+  uint32_t n = 0;
+  for (sieve_t k = start / 64; k <= (end - 1) / 64; k++) {
+
+    /* bit i of odd is set if offset 2i + 1 of this word is a candidate */
+    const uint32_t odd = _pext_u64(candidate_bits(sieve, k, start, end), ODD_BITS);
+
+    _mm512_mask_compressstoreu_epi32(dst + n, (__mmask16) odd, low);
+    n += _mm_popcnt_u32(odd & 0xFFFF);
+    _mm512_mask_compressstoreu_epi32(dst + n, (__mmask16) (odd >> 16), high);
+    n += _mm_popcnt_u32(odd >> 16);
+
+    low  = _mm512_add_epi32(low, sixty_four);
+    high = _mm512_add_epi32(high, sixty_four);
+  }
+
+  return n;
+}
+
+typedef uint32_t (*extract_candidates_t)(const sieve_t *, 
+                                         sieve_t, 
+                                         sieve_t, 
+                                         uint32_t, 
+                                         uint32_t *);
+
+/* selects the extraction for the current cpu */
+static extract_candidates_t select_extract_candidates() {
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("bmi2"))
+    return extract_candidates_avx512;
+
+  return extract_candidates_scalar;
+}
+
+/**
+ * writes all odd offsets within [start, end) which are not marked as
+ * composite in the given sieve (plus add) into dst and returns the number
+ * of written offsets
+ */
+uint32_t extract_candidates(const sieve_t *sieve, 
+                            sieve_t start, 
+                            sieve_t end, 
+                            uint32_t add, 
+                            uint32_t *dst) {
+
+  static const extract_candidates_t extract = select_extract_candidates();
+
+  if (start >= end)
+    return 0;
+
+  return extract(sieve, start, end, add, dst);
+}
+
+/**
+ * returns the unmarked bits of word k of a sieve with one bit per odd
+ * offset, which belong to the bits [first, last)
+ */
+static inline sieve_t odd_candidate_bits(const sieve_t *sieve, 
+                                         sieve_t k, 
+                                         sieve_t first, 
+                                         sieve_t last) {
+
+  sieve_t bits = ~sieve[k];
+
+  if (k == first / 64)
+    bits &= ~((sieve_t) 0) << (first % 64);
+  if (k == (last - 1) / 64 && last % 64 != 0)
+    bits &= (((sieve_t) 1) << (last % 64)) - 1;
+
+  return bits;
+}
+
+/* extracts the odd sieve candidates of the bits [first, last) bit by bit */
+static uint32_t extract_odd_candidates_scalar(const sieve_t *sieve, 
+                                              sieve_t first, 
+                                              sieve_t last, 
+                                              uint32_t add, 
+                                              uint32_t *dst) {
+
+  uint32_t n = 0;
+  for (sieve_t k = first / 64; k <= (last - 1) / 64; k++) {
+
+    sieve_t bits = odd_candidate_bits(sieve, k, first, last);
+    const uint32_t base = add + k * 128 + 1;
+
+    while (bits) {
+      dst[n++] = base + 2 * __builtin_ctzll(bits);
+      bits &= bits - 1;
+    }
+  }
+
+  return n;
+}
+
+/* extracts the odd sieve candidates with avx512 compress stores */
+__attribute__((target("avx512f,popcnt")))
+static uint32_t extract_odd_candidates_avx512(const sieve_t *sieve, 
+                                              sieve_t first, 
+                                              sieve_t last, 
+                                              uint32_t add, 
+                                              uint32_t *dst) {
+
+  /* the offsets of the four 16 bit quarters of a word */
+  const __m512i step = _mm512_set1_epi32(128);
+  __m512i offsets[4];
+
+  offsets[0] = _mm512_setr_epi32( 1,  3,  5,  7,  9, 11, 13, 15,
+                                 17, 19, 21, 23, 25, 27, 29, 31);
+  offsets[0] = _mm512_add_epi32(offsets[0], _mm512_set1_epi32(add + (first / 64) * 128));
+
+  for (int q = 1; q < 4; q++)
+    offsets[q] = _mm512_add_epi32(offsets[q - 1], _mm512_set1_epi32(32));
+
+  uint32_t n = 0;
+  for (sieve_t k = first / 64; k <= (last - 1) / 64; k++) {
+
+    const sieve_t bits = odd_candidate_bits(sieve, k, first, last);
+
+    for (int q = 0; q < 4; q++) {
+      const uint32_t mask = (bits >> (16 * q)) & 0xFFFF;
+
+      _mm512_mask_compressstoreu_epi32(dst + n, (__mmask16) mask, offsets[q]);
+      n += _mm_popcnt_u32(mask);
+      offsets[q] = _mm512_add_epi32(offsets[q], step);
+    }
+  }
+
+  return n;
+}
+
+/* selects the odd extraction for the current cpu */
+static extract_candidates_t select_extract_odd_candidates() {
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return extract_odd_candidates_avx512;
+
+  return extract_odd_candidates_scalar;
+}
+
+/**
+ * like extract_candidates, but for a sieve with one bit per odd offset
+ * (bit k belongs to offset 2k + 1)
+ */
+uint32_t extract_odd_candidates(const sieve_t *sieve, 
+                                sieve_t start, 
+                                sieve_t end, 
+                                uint32_t add, 
+                                uint32_t *dst) {
+
+  static const extract_candidates_t extract = select_extract_odd_candidates();
+
+  /* the bits of the odd offsets within [start, end) */
+  const sieve_t first = start / 2;
+  const sieve_t last  = end / 2;
+
+  if (first >= last)
+    return 0;
+
+  return extract(sieve, first, last, add, dst);
+}
+
+/**
+ * returns the number of odd offsets within [start, end) which are not 
+ * marked as composite in the given sieve
+ */
+uint32_t count_candidates(const sieve_t *sieve, sieve_t start, sieve_t end) {
+
+  if (start >= end)
+    return 0;
+
+  uint32_t n = 0;
+  for (sieve_t k = start / 64; k <= (end - 1) / 64; k++)
+    n += __builtin_popcountll(candidate_bits(sieve, k, start, end));
+
+  return n;
+}
+
+/**
+ * returns the expected number of numbers within a window of the given size
+ * which are not divisible by any of the given primes
+ */
+double expected_candidates(const sieve_t *primes, sieve_t n_primes, sieve_t size) {
+
+  /* sum the logarithms to keep the precision for millions of primes */
+  double log_ratio = 0.0;
+  for (sieve_t i = 0; i < n_primes; i++)
+    log_ratio += log1p(-1.0 / primes[i]);
+
+  return size * exp(log_ratio);
+}
+
+/* returns the size of the level 2 cache in bytes */
+sieve_t l2_cache_size() {
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  const long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+  if (size > 0)
+    return size;
+#endif
+
+  return DEFAULT_L2_CACHE_SIZE;
+}
@@ -222,6 +222,46 @@ static inline double mpz_log(mpz_t mpz) {
 #define popcount(X) __builtin_popcountll(X)
 #endif
 
+/**
+ * writes all odd offsets within [start, end) which are not marked as
+ * composite in the given sieve (plus add) into dst and returns the number
+ * of written offsets (dst needs space for (end - start) / 2 + 1 offsets)
+ */
+uint32_t extract_candidates(const sieve_t *sieve, 
+                            sieve_t start, 
+                            sieve_t end, 
+                            uint32_t add, 
+                            uint32_t *dst);
+
+/**
+ * like extract_candidates, but for a sieve with one bit per odd offset
+ * (bit k belongs to offset 2k + 1)
+ */
+uint32_t extract_odd_candidates(const sieve_t *sieve, 
+                                sieve_t start, 
+                                sieve_t end, 
+                                uint32_t add, 
+                                uint32_t *dst);
+
+/**
+ * returns the number of odd offsets within [start, end) which are not 
+ * marked as composite in the given sieve
+ */
+uint32_t count_candidates(const sieve_t *sieve, sieve_t start, sieve_t end);
+
+/**
+ * returns the expected number of numbers within a window of the given size
+ * which are not divisible by any of the given primes: size * prod(1 - 1/p)
+ * (exact for uniformly distributed window offsets)
+ */
+double expected_candidates(const sieve_t *primes, sieve_t n_primes, sieve_t size);
+
+/* default size of the level 2 cache in bytes, if it can't be detected */
+#define DEFAULT_L2_CACHE_SIZE (256 * 1024)
+
+/* returns the size of the level 2 cache in bytes */
+sieve_t l2_cache_size();
+
 
 
 #endif /* __UTILS_H__ */
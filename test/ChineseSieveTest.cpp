@@ -0,0 +1,161 @@
+/**
+ * Test of the batch sieve of the ChineseSieve
+ *
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "ChineseSieve.h"
+#include "Opts.h"
+
+using namespace std;
+
+/* the crt file and the number of sieve primes of the test */
+#define TEST_CRT_FILE "crt/crt-22m-256s.txt"
+#define TEST_N_PRIMES 200000
+
+/* number of additional shift bits (2^bits gaps per run) */
+#define TEST_SHIFT_BITS 8
+
+/* ignores all shares */
+class TestProcessor : public PoWProcessor {
+
+  public:
+
+    bool process(PoW *pow) {
+      (void) pow;
+      return false;
+    }
+};
+
+/**
+ * Sieves the same gaps with the batch sieve and with the sieve of
+ * single gaps, first for a small and then for a larger target, so the
+ * batch sieve has to forget the hits above the prevoius sievesize.
+ */
+class ChineseSieveTest {
+
+  public:
+
+    /* returns whether the batch sieve found the same gaps */
+    static bool run();
+
+  private:
+
+    /* sieves the gaps for the given merit, and returns them sorted */
+    static void sieve(ChineseSieve *csieve,
+                      ChineseSet *cset,
+                      double merit,
+                      vector<string> &gaps);
+};
+
+/* sieves the gaps for the given merit, and returns them sorted */
+void ChineseSieveTest::sieve(ChineseSieve *csieve,
+                             ChineseSet *cset,
+                             double merit,
+                             vector<string> &gaps) {
+
+  mpz_t mpz_hash, mpz_adder, mpz_start;
+  mpz_init_set_str(mpz_hash, "d3a1f00ee1d2c3b4a5968778695a4b3c"
+                             "2d1e0f00112233445566778899aabbc1", 16);
+  mpz_init_set_ui(mpz_adder, 0);
+  mpz_init(mpz_start);
+
+  PoW pow(mpz_hash,
+          cset->bit_size + TEST_SHIFT_BITS,
+          mpz_adder,
+          (uint64_t) (merit * TWO_POW48),
+          0);
+
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  memset(hash, 1, SHA256_DIGEST_LENGTH);
+  memcpy(ChineseSieve::hash_prev_block, hash, SHA256_DIGEST_LENGTH);
+
+  csieve->run_sieve(&pow, hash);
+
+  uint32_t *candidates = (uint32_t *) malloc(sizeof(uint32_t) * (cset->byte_size * 4 + 1));
+  GapCandidate *gap;
+  gaps.clear();
+
+  while ((gap = ChineseSieve::gaps->pop(0)) != NULL) {
+    gap->get_start(mpz_start);
+    gap->get_candidates(candidates);
+
+    stringstream ss;
+    ss << mpz_get_str(NULL, 16, mpz_start) << ":";
+    for (uint32_t i = 0; i < gap->n_candidates; i++)
+      ss << " " << candidates[i];
+
+    gaps.push_back(ss.str());
+    GapArena::release(gap);
+  }
+  sort(gaps.begin(), gaps.end());
+
+  free(candidates);
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_adder);
+  mpz_clear(mpz_start);
+}
+
+/* returns whether the batch sieve found the same gaps */
+bool ChineseSieveTest::run() {
+
+  TestProcessor processor;
+  ChineseSet *cset = new ChineseSet(TEST_CRT_FILE);
+  ChineseSieve *batch  = new ChineseSieve(&processor, TEST_N_PRIMES, cset);
+  ChineseSieve *single = new ChineseSieve(&processor, TEST_N_PRIMES, cset);
+  single->use_batches = false;
+
+  /* the merit of a gap over the whole ChineseSet */
+  const double merit = cset->size / ((256 + cset->bit_size + TEST_SHIFT_BITS) * log(2));
+  const double merits[] = { merit / 2, merit * 0.95 };
+
+  bool result = true;
+  for (sieve_t i = 0; i < sizeof(merits) / sizeof(merits[0]); i++) {
+    vector<string> batch_gaps, single_gaps;
+
+    sieve(batch,  cset, merits[i], batch_gaps);
+    sieve(single, cset, merits[i], single_gaps);
+
+    const bool equal = !single_gaps.empty() && batch_gaps == single_gaps;
+    cout << "merit " << merits[i] << ": " << batch_gaps.size() << " batch gaps, ";
+    cout << single_gaps.size() << " single gaps " << (equal ? "ok" : "FAILED") << endl;
+    result = result && equal;
+  }
+
+  delete batch;
+  delete single;
+  delete cset;
+
+  return result;
+}
+
+int main() {
+
+  char *argv[] = { (char *) "ChineseSieveTest",
+                   (char *) "--bucket-sieve",
+                   (char *) "--batch-sieve",
+                   NULL };
+
+  Opts::get_instance(3, argv);
+  return ChineseSieveTest::run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,150 @@
+/**
+ * Test of the memory budget of the GapQueue
+ *
+ * Copyright (C)  2014  The Gapcoin developers  <info@gapcoin.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <iostream>
+#include <vector>
+#include "GapQueue.h"
+#include "GapArena.h"
+
+using namespace std;
+
+/* number of producer and consumer threads (one shard per consumer) */
+#define TEST_THREADS 4
+
+/* gaps per producer, and gaps per push */
+#define TEST_GAPS  200000
+#define TEST_BATCH 64
+
+/* the memory budget of the queue */
+#define TEST_BUDGET (8 << 20)
+
+/* the queue of the test */
+static GapQueue *queue;
+
+/* number of running producers */
+static volatile int n_producers = TEST_THREADS;
+
+/* peak bytes of the slabs and of the resident memory */
+static volatile uint64_t peak_slabs = 0;
+static volatile uint64_t peak_rss   = 0;
+
+/* returns the resident memory of this process in bytes */
+static uint64_t rss() {
+
+  uint64_t size = 0, resident = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (file != NULL) {
+    if (fscanf(file, "%" SCNu64 " %" SCNu64, &size, &resident) != 2)
+      resident = 0;
+    fclose(file);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* samples the peak memory */
+static void sample() {
+
+  const uint64_t slabs = GapArena::get_bytes();
+  const uint64_t res   = rss();
+  if (slabs > peak_slabs) peak_slabs = slabs;
+  if (res   > peak_rss)   peak_rss   = res;
+}
+
+/* pushes gaps with a random number of candidates (so random scores) */
+static void *produce(void *args) {
+
+  unsigned seed = (unsigned) (uint64_t) args;
+  uint32_t candidates[300];
+  vector<GapCandidate *> gaps;
+  GapArena arena;
+
+  mpz_t mpz_start;
+  mpz_init_set_str(mpz_start, "123456789012345678901234567890123456789", 10);
+  GapBase *base = new GapBase(1, 20ULL << 48, mpz_start, mpz_start);
+
+  for (uint32_t i = 0; i < TEST_GAPS; i++) {
+    const uint32_t n = rand_r(&seed) % 300 + 1;
+    for (uint32_t j = 0; j < n; j++)
+      candidates[j] = 2 * j + 1;
+
+    gaps.push_back(arena.alloc(base, i, candidates, n));
+    if (gaps.size() == TEST_BATCH)
+      queue->push(gaps);
+  }
+  queue->push(gaps);
+
+  base->release();
+  mpz_clear(mpz_start);
+  __sync_fetch_and_sub(&n_producers, 1);
+  return NULL;
+}
+
+/* pops the gaps slower than they are pushed */
+static void *consume(void *args) {
+
+  const sieve_t shard = (sieve_t) (uint64_t) args;
+  for (;;) {
+    GapCandidate *gap = queue->wait_pop(shard);
+    if (gap == NULL) {
+      if (n_producers == 0 && queue->size() == 0)
+        return NULL;
+      continue;
+    }
+
+    for (volatile int i = 0; i < 2000; i++);
+    GapArena::release(gap);
+  }
+}
+
+int main() {
+
+  queue = new GapQueue(TEST_THREADS, 1000, TEST_BUDGET, true);
+  const uint64_t start_rss = rss();
+
+  pthread_t producers[TEST_THREADS], consumers[TEST_THREADS];
+  for (uint64_t i = 0; i < TEST_THREADS; i++) {
+    pthread_create(&producers[i], NULL, produce, (void *) (i + 1));
+    pthread_create(&consumers[i], NULL, consume, (void *) i);
+  }
+
+  while (n_producers > 0) {
+    sample();
+    usleep(1000);
+  }
+
+  for (int i = 0; i < TEST_THREADS; i++) {
+    pthread_join(producers[i], NULL);
+    pthread_join(consumers[i], NULL);
+  }
+  delete queue;
+
+  /* the current slab of each arena is charged on top of the budget */
+  const uint64_t slack = 2 * TEST_THREADS * (GAP_SLAB_SIZE + sizeof(GapSlab));
+  const bool bounded = peak_slabs <= TEST_BUDGET + slack &&
+                       peak_rss - start_rss <= 2 * (TEST_BUDGET + slack);
+
+  cout << "peak slabs " << (peak_slabs >> 10) << " KB, peak rss +";
+  cout << ((peak_rss - start_rss) >> 10) << " KB, slabs left ";
+  cout << GapArena::get_bytes() << " bytes " << (bounded ? "ok" : "FAILED") << endl;
+
+  return (bounded && GapArena::get_bytes() == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}